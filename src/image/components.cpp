@@ -0,0 +1,155 @@
+/*Connected component labelling
+    *two-pass union-find over 8-connected white pixels, strips of rows labelled in parallel
+    *area, bounding box and centroid of every component gathered with the final labels
+
+    Biomedical Image Processing
+    Edgar Aguilera Hernández
+    02/01/2025
+*/
+
+#include <vector>
+#include <algorithm>
+#include "components.hpp"
+#include "morph_op.hpp"
+#include "parallel.hpp"
+
+using namespace std;
+
+/*root of label with path halving*/
+static int findRoot(vector<int> &parent, int label){
+    while(parent[label] != label){
+        parent[label] = parent[parent[label]];
+        label = parent[label];
+    }
+    return label;
+}
+
+/*merge two label sets keeping the smallest root, returns the root*/
+static int mergeRoots(vector<int> &parent, int a, int b){
+    a = findRoot(parent, a);
+    b = findRoot(parent, b);
+    if(a < b){
+        parent[b] = a;
+        return a;
+    }
+    parent[a] = b;
+    return b;
+}
+
+/*provisional labels of rows first_row .. last_row - 1, the row above first_row is treated as background
+    labels start at first_row*cols + 1, so strips never share a label
+*/
+static void labelStrip(int **img, int **labels, int first_row, int last_row, int cols, vector<int> &parent){
+    int next_label = first_row*cols + 1;
+    for(int y = first_row; y < last_row; y++){
+        const int *row = img[y];
+        const int *up = (y > first_row) ? labels[y-1] : nullptr;
+        int *cur = labels[y];
+        for(int x = 0; x < cols; x++){
+            cur[x] = 0;
+            if(row[x] == 0)
+                continue;
+
+            //upper left (a), upper (b), upper right (c) and left (d): b touches a, c and d, a and d touch each other
+            int a = (up != nullptr && x > 0) ? up[x-1] : 0;
+            int b = (up != nullptr) ? up[x] : 0;
+            int c = (up != nullptr && x+1 < cols) ? up[x+1] : 0;
+            int d = (x > 0) ? cur[x-1] : 0;
+
+            if(b != 0)
+                cur[x] = b;
+            else if(c != 0)
+                cur[x] = (a != 0) ? mergeRoots(parent, c, a) : (d != 0) ? mergeRoots(parent, c, d) : c;
+            else if(a != 0)
+                cur[x] = a;
+            else if(d != 0)
+                cur[x] = d;
+            else
+                cur[x] = next_label++;
+        }
+    }
+}
+
+/*label 8-connected components of pixels with value != 0, rows split in strips across n_threads (0: every hardware thread)
+    labels are 1 .. stats.size() in raster order of the first pixel of each component (0: background),
+    stats[label-1] receives the statistics of every label
+*/
+int** labelComponents(int **img, int rows, int cols, vector<ComponentStats> &stats, int n_threads){
+    int** labels = createMatrix(rows, cols, 0);
+    stats.clear();
+    if(rows <= 0 || cols <= 0)
+        return labels;
+
+    if(n_threads <= 0)
+        n_threads = hardwareThreads();
+    int n_strips = max(1, min(n_threads, rows));
+    int strip_rows = (rows + n_strips - 1) / n_strips;
+    n_strips = (rows + strip_rows - 1) / strip_rows;
+
+    //label 0 is background, every pixel can hold one provisional label
+    vector<int> parent((size_t)rows*cols + 1);
+    for(size_t l = 0; l < parent.size(); l++){
+        parent[l] = l;
+    }
+
+    //1. provisional labels per strip, strips only write their own label range
+    parallelTasks(n_strips, [&](int s){
+        labelStrip(img, labels, s*strip_rows, min(rows, (s+1)*strip_rows), cols, parent);
+    }, n_threads);
+
+    //2. merge across the first row of every strip
+    for(int s = 1; s < n_strips; s++){
+        int y = s*strip_rows;
+        const int *up = labels[y-1];
+        const int *cur = labels[y];
+        for(int x = 0; x < cols; x++){
+            if(cur[x] == 0)
+                continue;
+            for(int k = max(x-1, 0); k <= min(x+1, cols-1); k++){
+                if(up[k] != 0)
+                    mergeRoots(parent, cur[x], up[k]);
+            }
+        }
+    }
+
+    //roots are always the smallest label of their set, so one increasing pass flattens every chain
+    for(size_t l = 1; l < parent.size(); l++){
+        parent[l] = parent[parent[l]];
+    }
+
+    //3. final labels in raster order and statistics
+    vector<int> final_label(parent.size(), 0);
+    vector<double> sum_y, sum_x;
+    for(int y = 0; y < rows; y++){
+        int *row = labels[y];
+        for(int x = 0; x < cols; x++){
+            if(row[x] == 0)
+                continue;
+            int root = parent[row[x]];
+            if(final_label[root] == 0){
+                ComponentStats component;
+                component.min_y = component.max_y = y;
+                component.min_x = component.max_x = x;
+                stats.push_back(component);
+                sum_y.push_back(0);
+                sum_x.push_back(0);
+                final_label[root] = stats.size();
+            }
+            int label = final_label[root];
+            ComponentStats &component = stats[label-1];
+            component.area++;
+            component.min_x = min(component.min_x, x);
+            component.max_x = max(component.max_x, x);
+            component.max_y = y;
+            sum_y[label-1] += y;
+            sum_x[label-1] += x;
+            row[x] = label;
+        }
+    }
+
+    for(int l = 0; l < (int)stats.size(); l++){
+        stats[l].centroid_y = sum_y[l] / stats[l].area;
+        stats[l].centroid_x = sum_x[l] / stats[l].area;
+    }
+    return labels;
+}
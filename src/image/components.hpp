@@ -0,0 +1,34 @@
+/*Connected component labelling
+    *two-pass union-find over 8-connected white pixels, strips of rows labelled in parallel
+    *area, bounding box and centroid of every component gathered with the final labels
+
+    Biomedical Image Processing
+    Edgar Aguilera Hernández
+    02/01/2025
+*/
+
+#ifndef COMPONENTS_HPP
+#define COMPONENTS_HPP
+
+#include <vector>
+
+using namespace std;
+
+/*statistics of one connected component*/
+struct ComponentStats{
+    int area = 0;               //pixels
+    int min_y = 0;              //bounding box, inclusive
+    int min_x = 0;
+    int max_y = 0;
+    int max_x = 0;
+    double centroid_y = 0;
+    double centroid_x = 0;
+};
+
+/*label 8-connected components of pixels with value != 0, rows split in strips across n_threads (0: every hardware thread)
+    labels are 1 .. stats.size() in raster order of the first pixel of each component (0: background),
+    stats[label-1] receives the statistics of every label
+*/
+int** labelComponents(int **img, int rows, int cols, vector<ComponentStats> &stats, int n_threads = 0);
+
+#endif
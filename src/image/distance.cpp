@@ -0,0 +1,86 @@
+/*Distance transforms
+    *exact euclidean distance transform (Felzenszwalb-Huttenlocher), linear time
+
+    Biomedical Image Processing
+    Edgar Aguilera Hernández
+    02/01/2025
+*/
+
+#include <vector>
+#include <cmath>
+#include "distance.hpp"
+#include "morph_op.hpp"
+
+using namespace std;
+
+/*1D squared distance transform of sampled function f using lower envelope of parabolas*/
+static void distanceTransform1D(const double *f, int n, double *d, int *v, double *z){
+    int k = 0;
+    v[0] = 0;
+    z[0] = -DISTANCE_INF;
+    z[1] = DISTANCE_INF;
+
+    //lower envelope
+    for(int q = 1; q < n; q++){
+        double s = ((f[q] + (double)q*q) - (f[v[k]] + (double)v[k]*v[k])) / (2.0*q - 2.0*v[k]);
+        while(s <= z[k]){
+            k--;
+            s = ((f[q] + (double)q*q) - (f[v[k]] + (double)v[k]*v[k])) / (2.0*q - 2.0*v[k]);
+        }
+        k++;
+        v[k] = q;
+        z[k] = s;
+        z[k+1] = DISTANCE_INF;
+    }
+
+    //evaluate envelope
+    k = 0;
+    for(int q = 0; q < n; q++){
+        while(z[k+1] < q)
+            k++;
+        d[q] = (double)(q - v[k])*(q - v[k]) + f[v[k]];
+    }
+}
+
+/*squared euclidean distance from every pixel to the closest feature pixel (img > 0)*/
+double** squaredDistanceTransform(int **img, int rows, int cols){
+    double **dist = createDoubleMatrix(rows, cols, 0);
+
+    int n = rows > cols ? rows : cols;
+    vector<double> f(n), d(n), z(n+1);
+    vector<int> v(n);
+
+    //columns
+    for(int j = 0; j < cols; j++){
+        for(int i = 0; i < rows; i++){
+            f[i] = img[i][j] > 0 ? 0 : DISTANCE_INF;
+        }
+        distanceTransform1D(f.data(), rows, d.data(), v.data(), z.data());
+        for(int i = 0; i < rows; i++){
+            dist[i][j] = d[i];
+        }
+    }
+
+    //rows
+    for(int i = 0; i < rows; i++){
+        for(int j = 0; j < cols; j++){
+            f[j] = dist[i][j];
+        }
+        distanceTransform1D(f.data(), cols, dist[i], v.data(), z.data());
+    }
+
+    return dist;
+}
+
+/*euclidean distance from every pixel to the closest feature pixel (img > 0)*/
+double** euclideanDistanceTransform(int **img, int rows, int cols){
+    double **dist = squaredDistanceTransform(img, rows, cols);
+
+    for(int i = 0; i < rows; i++){
+        for(int j = 0; j < cols; j++){
+            if(dist[i][j] < DISTANCE_INF)
+                dist[i][j] = sqrt(dist[i][j]);
+        }
+    }
+    return dist;
+}
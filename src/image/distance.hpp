@@ -0,0 +1,23 @@
+/*Distance transforms
+    *exact euclidean distance transform (Felzenszwalb-Huttenlocher), linear time
+
+    Biomedical Image Processing
+    Edgar Aguilera Hernández
+    02/01/2025
+*/
+
+#ifndef DISTANCE_HPP
+#define DISTANCE_HPP
+
+using namespace std;
+
+/*distance assigned to pixels without any feature pixel in the image*/
+const double DISTANCE_INF = 1e20;
+
+/*squared euclidean distance from every pixel to the closest feature pixel (img > 0)*/
+double** squaredDistanceTransform(int **img, int rows, int cols);
+
+/*euclidean distance from every pixel to the closest feature pixel (img > 0)*/
+double** euclideanDistanceTransform(int **img, int rows, int cols);
+
+#endif
@@ -0,0 +1,362 @@
+/*Frequency domain convolution
+    *radix-2 complex FFT
+    *2D real FFT (two rows packed per complex transform)
+    *cached kernel transforms
+    *max response of a kernel bank
+
+    Biomedical Image Processing
+    Edgar Aguilera Hernández
+    02/01/2025
+*/
+
+#include <complex>
+#include <vector>
+#include <map>
+#include <mutex>
+#include <cmath>
+#include <cstdint>
+#include <memory>
+#include "fft.hpp"
+#include "morph_op.hpp"
+#include "parallel.hpp"
+
+using namespace std;
+
+/*kernel transform stored for a given padded size*/
+struct KernelSpectrum{
+    int k_rows;
+    int k_cols;
+    int P;
+    int Q;
+    vector<int> taps;
+    shared_ptr<vector<complex<double>>> spectrum;
+};
+
+//cached kernel transforms keyed by content hash
+static map<uint64_t, KernelSpectrum> kernel_cache;
+static mutex kernel_cache_lock;
+//max number of cached transforms before flushing
+static const int KERNEL_CACHE_MAX = 64;
+
+/*smallest power of two greater or equal than n*/
+int nextPowerOfTwo(int n){
+    int p = 1;
+    while(p < n)
+        p <<= 1;
+    return p;
+}
+
+/*in-place iterative radix-2 FFT, n must be a power of two (inverse is not scaled)*/
+void fftRadix2(complex<double>* data, int n, bool inverse){
+    //twiddle table exp(-2*pi*i*k/n) reused while n does not change
+    thread_local vector<complex<double>> twiddle;
+    thread_local int twiddle_n = 0;
+    if(twiddle_n != n){
+        twiddle.resize(n/2 + 1);
+        for(int k = 0; k < n/2 + 1; k++){
+            twiddle[k] = polar(1.0, -2*M_PI*k/n);
+        }
+        twiddle_n = n;
+    }
+
+    //bit reversal permutation
+    for(int i = 1, j = 0; i < n; i++){
+        int bit = n >> 1;
+        for(; j & bit; bit >>= 1)
+            j ^= bit;
+        j ^= bit;
+        if(i < j)
+            swap(data[i], data[j]);
+    }
+
+    //butterflies
+    for(int len = 2; len <= n; len <<= 1){
+        int half = len/2;
+        int step = n/len;
+        for(int i = 0; i < n; i += len){
+            for(int j = 0; j < half; j++){
+                complex<double> w = inverse ? conj(twiddle[j*step]) : twiddle[j*step];
+                complex<double> u = data[i+j];
+                complex<double> v = data[i+j+half] * w;
+                data[i+j] = u + v;
+                data[i+j+half] = u - v;
+            }
+        }
+    }
+}
+
+/*check if kernel is large enough for the FFT path (taps_threshold <= 0 disables it)*/
+bool fftConvolutionPreferred(int k_rows, int k_cols, int taps_threshold){
+    if(taps_threshold <= 0)
+        return false;
+    return k_rows*k_cols >= taps_threshold;
+}
+
+/*forward 2D FFT of a real plane zero padded to P x Q, only src_rows rows are non zero
+    fill(r, row) writes Q real values of row r; spectrum is stored by columns [k*P + p], k = 0..Q/2
+*/
+template<typename RowFill>
+static void realForward2D(int src_rows, int P, int Q, RowFill fill, vector<complex<double>> &spectrum){
+    int half = Q/2 + 1;
+    spectrum.assign((size_t)half*P, complex<double>(0,0));
+
+    vector<double> row_a(Q), row_b(Q);
+    vector<complex<double>> z(Q);
+
+    //two real rows packed as real and imaginary part of one complex transform
+    for(int r = 0; r < src_rows; r += 2){
+        fill(r, row_a.data());
+        if(r+1 < src_rows)
+            fill(r+1, row_b.data());
+        else
+            fill(-1, row_b.data());
+
+        for(int n = 0; n < Q; n++){
+            z[n] = complex<double>(row_a[n], row_b[n]);
+        }
+        fftRadix2(z.data(), Q);
+
+        //split both spectra using hermitian symmetry
+        for(int k = 0; k < half; k++){
+            complex<double> zk = z[k];
+            complex<double> zc = conj(z[(Q-k) % Q]);
+            spectrum[(size_t)k*P + r] = (zk + zc)*0.5;
+            if(r+1 < src_rows)
+                spectrum[(size_t)k*P + r+1] = (zk - zc)*complex<double>(0,-0.5);
+        }
+    }
+
+    //column transforms
+    for(int k = 0; k < half; k++){
+        fftRadix2(&spectrum[(size_t)k*P], P);
+    }
+}
+
+/*inverse of realForward2D, writing the first out_rows rows through store(r, row)*/
+template<typename RowStore>
+static void realInverse2D(vector<complex<double>> &spectrum, int out_rows, int P, int Q, RowStore store){
+    int half = Q/2 + 1;
+    double scale = 1.0/((double)P*Q);
+
+    //column inverse transforms
+    for(int k = 0; k < half; k++){
+        fftRadix2(&spectrum[(size_t)k*P], P, true);
+    }
+
+    vector<complex<double>> z(Q);
+    vector<double> row_a(Q), row_b(Q);
+
+    //two rows recovered from one complex transform
+    for(int r = 0; r < out_rows; r += 2){
+        for(int k = 0; k < Q; k++){
+            complex<double> a, b;
+            if(k < half){
+                a = spectrum[(size_t)k*P + r];
+                b = spectrum[(size_t)k*P + r+1];
+            }else{
+                a = conj(spectrum[(size_t)(Q-k)*P + r]);
+                b = conj(spectrum[(size_t)(Q-k)*P + r+1]);
+            }
+            z[k] = a + complex<double>(0,1)*b;
+        }
+        fftRadix2(z.data(), Q, true);
+
+        for(int n = 0; n < Q; n++){
+            row_a[n] = z[n].real()*scale;
+            row_b[n] = z[n].imag()*scale;
+        }
+        store(r, row_a.data());
+        if(r+1 < out_rows)
+            store(r+1, row_b.data());
+    }
+}
+
+/*hash of kernel values and padded size*/
+static uint64_t kernelHash(int **kernel, int k_rows, int k_cols, int P, int Q){
+    //FNV-1a
+    uint64_t h = 1469598103934665603ULL;
+    int header[4] = {k_rows, k_cols, P, Q};
+    for(int i = 0; i < 4; i++){
+        h = (h ^ (uint64_t)(uint32_t)header[i]) * 1099511628211ULL;
+    }
+    for(int i = 0; i < k_rows; i++){
+        for(int j = 0; j < k_cols; j++){
+            h = (h ^ (uint64_t)(uint32_t)kernel[i][j]) * 1099511628211ULL;
+        }
+    }
+    return h;
+}
+
+/*get kernel transform for a P x Q padded plane, computing it only the first time*/
+static shared_ptr<vector<complex<double>>> kernelSpectrum(int **kernel, int k_rows, int k_cols, int P, int Q){
+    uint64_t key = kernelHash(kernel, k_rows, k_cols, P, Q);
+
+    vector<int> taps(k_rows*k_cols);
+    for(int i = 0; i < k_rows; i++){
+        for(int j = 0; j < k_cols; j++){
+            taps[i*k_cols + j] = kernel[i][j];
+        }
+    }
+
+    lock_guard<mutex> guard(kernel_cache_lock);
+
+    //avoid hash collisions comparing the stored taps
+    auto found = kernel_cache.find(key);
+    while(found != kernel_cache.end()){
+        KernelSpectrum &entry = found->second;
+        if(entry.k_rows == k_rows && entry.k_cols == k_cols && entry.P == P && entry.Q == Q && entry.taps == taps)
+            return entry.spectrum;
+        key++;
+        found = kernel_cache.find(key);
+    }
+
+    if((int)kernel_cache.size() >= KERNEL_CACHE_MAX)
+        kernel_cache.clear();
+
+    KernelSpectrum &entry = kernel_cache[key];
+    entry.k_rows = k_rows;
+    entry.k_cols = k_cols;
+    entry.P = P;
+    entry.Q = Q;
+    entry.taps = taps;
+    entry.spectrum = make_shared<vector<complex<double>>>();
+
+    //place kernel so circular convolution becomes correlation centered at (k_rows/2, k_cols/2)
+    int center_i = k_rows/2;
+    int center_j = k_cols/2;
+    vector<double> plane((size_t)P*Q, 0);
+    for(int i = 0; i < k_rows; i++){
+        for(int j = 0; j < k_cols; j++){
+            int u = ((center_i - i) % P + P) % P;
+            int v = ((center_j - j) % Q + Q) % Q;
+            plane[(size_t)u*Q + v] = kernel[i][j];
+        }
+    }
+
+    realForward2D(P, P, Q, [&](int r, double *row){
+        for(int n = 0; n < Q; n++){
+            row[n] = (r < 0) ? 0 : plane[(size_t)r*Q + n];
+        }
+    }, *entry.spectrum);
+
+    return entry.spectrum;
+}
+
+/*Correlate image with kernel in frequency domain, same window and borders as Image::convolution
+    result[y][x] = sum(img[y+i-k_rows/2][x+j-k_cols/2] * kernel[i][j]) / abs(div_c)
+*/
+int** fftConvolution(int **img, int rows, int cols, int **kernel, int k_rows, int k_cols, int div_c){
+    //padding big enough to avoid circular wrap into the image
+    int P = nextPowerOfTwo(rows + k_rows);
+    int Q = nextPowerOfTwo(cols + k_cols);
+
+    if(div_c == 0)
+        div_c = 1;
+
+    //shared handle keeps the transform alive if the cache is flushed meanwhile
+    shared_ptr<vector<complex<double>>> k_spectrum = kernelSpectrum(kernel, k_rows, k_cols, P, Q);
+
+    //image transform
+    vector<complex<double>> spectrum;
+    realForward2D(rows, P, Q, [&](int r, double *row){
+        for(int n = 0; n < Q; n++){
+            row[n] = (r < 0 || n >= cols) ? 0 : img[r][n];
+        }
+    }, spectrum);
+
+    //pointwise product
+    for(size_t n = 0; n < spectrum.size(); n++){
+        spectrum[n] *= (*k_spectrum)[n];
+    }
+
+    //back to spatial domain, rounding to the exact integer sum of the direct path
+    int **result = createMatrix(rows, cols, 0);
+    realInverse2D(spectrum, rows, P, Q, [&](int r, double *row){
+        for(int n = 0; n < cols; n++){
+            long long aux = llround(row[n]);
+            result[r][n] = (int)(aux / abs(div_c));
+        }
+    });
+
+    return result;
+}
+
+/*Correlate image with n_kernels kernels of k_rows x k_cols keeping the max response per pixel, the image is transformed once
+    response of kernel n is rounded as fftConvolution and divided by div_c[n], ties keep the lowest n (as applyFilterBank)
+    arg_max (optional rows x cols matrix) receives the index of the winning kernel, n_threads = 0 uses every hardware thread
+*/
+int** fftFilterBankMax(int **img, int rows, int cols, int ***kernels, int n_kernels, int k_rows, int k_cols, const int *div_c, int **arg_max, int n_threads){
+    int **result = createMatrix(rows, cols, 0);
+    if(n_kernels == 0)
+        return result;
+
+    int P = nextPowerOfTwo(rows + k_rows);
+    int Q = nextPowerOfTwo(cols + k_cols);
+
+    //image transform shared by every kernel
+    vector<complex<double>> img_spectrum;
+    realForward2D(rows, P, Q, [&](int r, double *row){
+        for(int n = 0; n < Q; n++){
+            row[n] = (r < 0 || n >= cols) ? 0 : img[r][n];
+        }
+    }, img_spectrum);
+
+    vector<shared_ptr<vector<complex<double>>>> k_spectra(n_kernels);
+    for(int n = 0; n < n_kernels; n++){
+        k_spectra[n] = kernelSpectrum(kernels[n], k_rows, k_cols, P, Q);
+    }
+
+    //every worker keeps max and arg-max over a contiguous range of kernels, ranges are merged in kernel order
+    map<int, pair<vector<int>, vector<int>>> partial;
+    mutex partial_lock;
+    parallelFor(0, n_kernels, [&](int k_begin, int k_end){
+        vector<int> best((size_t)rows*cols, 0);
+        vector<int> best_n((size_t)rows*cols, k_begin);
+        vector<complex<double>> spectrum;
+        for(int k = k_begin; k < k_end; k++){
+            spectrum = img_spectrum;
+            const vector<complex<double>> &k_spectrum = *k_spectra[k];
+            for(size_t n = 0; n < spectrum.size(); n++){
+                spectrum[n] *= k_spectrum[n];
+            }
+            realInverse2D(spectrum, rows, P, Q, [&](int r, double *row){
+                int *b = &best[(size_t)r*cols];
+                int *b_n = &best_n[(size_t)r*cols];
+                for(int n = 0; n < cols; n++){
+                    int response = (int)(llround(row[n]) / div_c[k]);
+                    if(k == k_begin || response > b[n]){
+                        b[n] = response;
+                        b_n[n] = k;
+                    }
+                }
+            });
+        }
+        lock_guard<mutex> guard(partial_lock);
+        partial[k_begin] = make_pair(move(best), move(best_n));
+    }, n_threads);
+
+    bool first = true;
+    for(auto &range : partial){
+        const vector<int> &best = range.second.first;
+        const vector<int> &best_n = range.second.second;
+        for(int y = 0; y < rows; y++){
+            for(int x = 0; x < cols; x++){
+                size_t c = (size_t)y*cols + x;
+                if(first || best[c] > result[y][x]){
+                    result[y][x] = best[c];
+                    if(arg_max != nullptr)
+                        arg_max[y][x] = best_n[c];
+                }
+            }
+        }
+        first = false;
+    }
+
+    return result;
+}
+
+/*release every cached kernel transform*/
+void clearFFTKernelCache(){
+    lock_guard<mutex> guard(kernel_cache_lock);
+    kernel_cache.clear();
+}
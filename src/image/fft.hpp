@@ -0,0 +1,45 @@
+/*Frequency domain convolution
+    *radix-2 complex FFT
+    *2D real FFT (two rows packed per complex transform)
+    *cached kernel transforms
+    *max response of a kernel bank
+
+    Biomedical Image Processing
+    Edgar Aguilera Hernández
+    02/01/2025
+*/
+
+#ifndef FFT_HPP
+#define FFT_HPP
+
+#include <complex>
+
+using namespace std;
+
+/*minimum number of kernel taps for the FFT path to replace direct convolution*/
+const int FFT_TAPS_THRESHOLD = 225;
+
+/*smallest power of two greater or equal than n*/
+int nextPowerOfTwo(int n);
+
+/*in-place iterative radix-2 FFT, n must be a power of two (inverse is not scaled)*/
+void fftRadix2(complex<double>* data, int n, bool inverse = false);
+
+/*check if kernel is large enough for the FFT path (taps_threshold <= 0 disables it)*/
+bool fftConvolutionPreferred(int k_rows, int k_cols, int taps_threshold = FFT_TAPS_THRESHOLD);
+
+/*Correlate image with kernel in frequency domain, same window and borders as Image::convolution
+    result[y][x] = sum(img[y+i-k_rows/2][x+j-k_cols/2] * kernel[i][j]) / abs(div_c)
+*/
+int** fftConvolution(int **img, int rows, int cols, int **kernel, int k_rows, int k_cols, int div_c);
+
+/*Correlate image with n_kernels kernels of k_rows x k_cols keeping the max response per pixel, the image is transformed once
+    response of kernel n is rounded as fftConvolution and divided by div_c[n], ties keep the lowest n (as applyFilterBank)
+    arg_max (optional rows x cols matrix) receives the index of the winning kernel, n_threads = 0 uses every hardware thread
+*/
+int** fftFilterBankMax(int **img, int rows, int cols, int ***kernels, int n_kernels, int k_rows, int k_cols, const int *div_c, int **arg_max = nullptr, int n_threads = 0);
+
+/*release every cached kernel transform*/
+void clearFFTKernelCache();
+
+#endif
@@ -0,0 +1,151 @@
+/*Oriented filter bank
+    *kernels of the same size compiled into a single tap list
+    *max response and arg-max orientation in one pass over the image
+    *large kernels through the cached-spectrum FFT path
+
+    Biomedical Image Processing
+    Edgar Aguilera Hernández
+    02/01/2025
+*/
+
+#include <vector>
+#include <cstdlib>
+#include "filter_bank.hpp"
+#include "parallel.hpp"
+#include "morph_op.hpp"
+
+using namespace std;
+
+/*compile n_kernels kernels of k_rows x k_cols into a filter bank*/
+FilterBank compileFilterBank(int ***kernels, int n_kernels, int k_rows, int k_cols){
+    FilterBank bank;
+    bank.n_kernels = n_kernels;
+    bank.k_rows = k_rows;
+    bank.k_cols = k_cols;
+
+    int center_i = k_rows/2;
+    int center_j = k_cols/2;
+
+    //division coefficient per kernel
+    for(int n = 0; n < n_kernels; n++){
+        int div_c = 0;
+        for(int i = 0; i < k_rows; i++){
+            for(int j = 0; j < k_cols; j++){
+                div_c += kernels[n][i][j];
+            }
+        }
+        if(div_c == 0)
+            div_c = 1;
+        bank.div_c.push_back(abs(div_c));
+    }
+
+    //keep taps that are non zero in any of the kernels
+    for(int i = 0; i < k_rows; i++){
+        for(int j = 0; j < k_cols; j++){
+            bool active = false;
+            for(int n = 0; n < n_kernels; n++){
+                if(kernels[n][i][j] != 0)
+                    active = true;
+            }
+            if(!active)
+                continue;
+
+            bank.tap_i.push_back(i - center_i);
+            bank.tap_j.push_back(j - center_j);
+            for(int n = 0; n < n_kernels; n++){
+                bank.weights.push_back(kernels[n][i][j]);
+            }
+        }
+    }
+
+    return bank;
+}
+
+/*apply every kernel of the bank at once keeping max response per pixel
+    arg_max (optional rows x cols matrix) receives the index of the winning kernel
+    n_threads = 0 uses every hardware thread
+    kernels with at least fft_taps taps are computed in frequency domain (fft_taps <= 0 forces direct path)
+*/
+int** applyFilterBank(const FilterBank &bank, int **img, int rows, int cols, int **arg_max, int n_threads, int fft_taps){
+    int n_kernels = bank.n_kernels;
+    int n_taps = (int)bank.tap_i.size();
+
+    if(n_kernels == 0)
+        return createMatrix(rows, cols, 0);
+
+    //dense kernels back from the tap list, their transforms are cached by fft.cpp
+    if(fftConvolutionPreferred(bank.k_rows, bank.k_cols, fft_taps)){
+        vector<int**> kernels(n_kernels);
+        for(int n = 0; n < n_kernels; n++){
+            kernels[n] = createMatrix(bank.k_rows, bank.k_cols, 0);
+            for(int t = 0; t < n_taps; t++){
+                kernels[n][bank.tap_i[t] + bank.k_rows/2][bank.tap_j[t] + bank.k_cols/2] = bank.weights[(size_t)t*n_kernels + n];
+            }
+        }
+        int **result = fftFilterBankMax(img, rows, cols, kernels.data(), n_kernels, bank.k_rows, bank.k_cols, bank.div_c.data(), arg_max, n_threads);
+        for(int n = 0; n < n_kernels; n++){
+            freeMatrix(kernels[n], bank.k_rows);
+        }
+        return result;
+    }
+
+    int **result = createMatrix(rows, cols, 0);
+
+    //zero padded copy so taps need no boundary checks (same borders as Image::convolution)
+    int pad_i = bank.k_rows/2;
+    int pad_j = bank.k_cols/2;
+    int p_cols = cols + 2*pad_j;
+    vector<int> padded((size_t)(rows + 2*pad_i)*p_cols, 0);
+    for(int i = 0; i < rows; i++){
+        for(int j = 0; j < cols; j++){
+            padded[(size_t)(i + pad_i)*p_cols + j + pad_j] = img[i][j];
+        }
+    }
+
+    //tap offsets inside padded image
+    vector<long> offset(n_taps);
+    for(int t = 0; t < n_taps; t++){
+        offset[t] = (long)bank.tap_i[t]*p_cols + bank.tap_j[t];
+    }
+
+    const int *weights = bank.weights.data();
+    const int *div_c = bank.div_c.data();
+
+    parallelFor(0, rows, [&](int row_begin, int row_end){
+        vector<int> acc(n_kernels);
+
+        for(int y = row_begin; y < row_end; y++){
+            const int *center = &padded[(size_t)(y + pad_i)*p_cols + pad_j];
+            for(int x = 0; x < cols; x++){
+                //read every neighbour once, updating all orientations
+                for(int n = 0; n < n_kernels; n++){
+                    acc[n] = 0;
+                }
+                for(int t = 0; t < n_taps; t++){
+                    int v = center[x + offset[t]];
+                    const int *w = weights + (size_t)t*n_kernels;
+                    for(int n = 0; n < n_kernels; n++){
+                        acc[n] += v * w[n];
+                    }
+                }
+
+                //running max and arg-max orientation
+                int best = acc[0] / div_c[0];
+                int best_n = 0;
+                for(int n = 1; n < n_kernels; n++){
+                    int response = acc[n] / div_c[n];
+                    if(response > best){
+                        best = response;
+                        best_n = n;
+                    }
+                }
+
+                result[y][x] = best;
+                if(arg_max != nullptr)
+                    arg_max[y][x] = best_n;
+            }
+        }
+    }, n_threads);
+
+    return result;
+}
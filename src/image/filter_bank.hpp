@@ -0,0 +1,40 @@
+/*Oriented filter bank
+    *kernels of the same size compiled into a single tap list
+    *max response and arg-max orientation in one pass over the image
+    *large kernels through the cached-spectrum FFT path
+
+    Biomedical Image Processing
+    Edgar Aguilera Hernández
+    02/01/2025
+*/
+
+#ifndef FILTER_BANK_HPP
+#define FILTER_BANK_HPP
+
+#include <vector>
+#include "fft.hpp"
+
+using namespace std;
+
+/*kernels compiled as a list of non zero taps, weights stored tap-major (n_kernels weights per tap)*/
+struct FilterBank{
+    int n_kernels = 0;
+    int k_rows = 0;
+    int k_cols = 0;
+    vector<int> tap_i;      //row offset from kernel center
+    vector<int> tap_j;      //column offset from kernel center
+    vector<int> weights;
+    vector<int> div_c;      //division coefficient per kernel, as Image::convolution
+};
+
+/*compile n_kernels kernels of k_rows x k_cols into a filter bank*/
+FilterBank compileFilterBank(int ***kernels, int n_kernels, int k_rows, int k_cols);
+
+/*apply every kernel of the bank at once keeping max response per pixel
+    arg_max (optional rows x cols matrix) receives the index of the winning kernel
+    n_threads = 0 uses every hardware thread
+    kernels with at least fft_taps taps are computed in frequency domain (fft_taps <= 0 forces direct path)
+*/
+int** applyFilterBank(const FilterBank &bank, int **img, int rows, int cols, int **arg_max = nullptr, int n_threads = 0, int fft_taps = FFT_TAPS_THRESHOLD);
+
+#endif
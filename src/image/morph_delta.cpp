@@ -0,0 +1,177 @@
+/*Delta erosion / dilation for binary structuring elements
+    *caches min and max of an image over an incumbent strel, with the tap that produced them
+    *a candidate strel is evaluated from the cache and only its added and removed taps
+
+    Biomedical Image Processing
+    Edgar Aguilera Hernández
+    02/01/2025
+*/
+
+#include <vector>
+#include "morph_delta.hpp"
+
+using namespace std;
+
+MorphDeltaCache::MorphDeltaCache(int **image, int n_rows, int n_cols, int **strel, int strel_radius){
+    img = image;
+    rows = n_rows;
+    cols = n_cols;
+    radius = strel_radius;
+
+    //empty incumbent: every tap of strel is an added tap
+    int len = 2*radius+1;
+    active.assign(len*len, 0);
+    min_plane.assign((size_t)rows*cols, 255);
+    max_plane.assign((size_t)rows*cols, 0);
+    min_tap.assign((size_t)rows*cols, -1);
+    max_tap.assign((size_t)rows*cols, -1);
+    rebase(strel);
+}
+
+/*true when every cell of strel is 0 or 1 (required by the cache)*/
+bool MorphDeltaCache::binaryStrel(int **strel, int strel_radius){
+    for(int k = 0; k < 2*strel_radius+1; k++){
+        for(int l = 0; l < 2*strel_radius+1; l++){
+            if(strel[k][l] != 0 && strel[k][l] != 1)
+                return false;
+        }
+    }
+    return true;
+}
+
+/*fill planes and winning taps for candidate strel starting from the cached ones*/
+void MorphDeltaCache::deltaPlanes(int **strel, vector<int> &c_min, vector<int> &c_max, vector<short> &c_min_tap, vector<short> &c_max_tap) const{
+    int len = 2*radius+1;
+    int n_taps = len*len;
+
+    //taps removed, added and kept with respect to incumbent
+    vector<char> removed(n_taps, 0);
+    vector<int> added;
+    vector<int> kept;
+    for(int t = 0; t < n_taps; t++){
+        bool candidate = strel[t/len][t%len] != 0;
+        if(active[t] && !candidate)
+            removed[t] = 1;
+        else if(!active[t] && candidate)
+            added.push_back(t);
+        else if(candidate)
+            kept.push_back(t);
+    }
+
+    c_min = min_plane;
+    c_max = max_plane;
+    c_min_tap = min_tap;
+    c_max_tap = max_tap;
+
+    //pixels whose winning tap was removed restart from initial value
+    vector<int> dirty_min;
+    vector<int> dirty_max;
+    for(size_t p = 0; p < c_min.size(); p++){
+        if(c_min_tap[p] >= 0 && removed[c_min_tap[p]]){
+            c_min[p] = 255;
+            c_min_tap[p] = -1;
+            dirty_min.push_back(p);
+        }
+        if(c_max_tap[p] >= 0 && removed[c_max_tap[p]]){
+            c_max[p] = 0;
+            c_max_tap[p] = -1;
+            dirty_max.push_back(p);
+        }
+    }
+
+    //added taps over the whole image, one shifted row per tap
+    for(int a = 0; a < (int)added.size(); a++){
+        int t = added[a];
+        int dk = t/len - radius;
+        int dl = t%len - radius;
+        int x_begin = dl < 0 ? -dl : 0;
+        int x_end = dl > 0 ? cols - dl : cols;
+
+        for(int y = 0; y < rows; y++){
+            int sy = y + dk;
+            if(sy < 0 || sy >= rows)
+                continue;
+            const int *src = img[sy] + dl;
+            int *p_min = &c_min[(size_t)y*cols];
+            int *p_max = &c_max[(size_t)y*cols];
+            short *p_min_tap = &c_min_tap[(size_t)y*cols];
+            short *p_max_tap = &c_max_tap[(size_t)y*cols];
+            for(int x = x_begin; x < x_end; x++){
+                int v = src[x];
+                if(v < p_min[x]){
+                    p_min[x] = v;
+                    p_min_tap[x] = t;
+                }
+                if(v > p_max[x]){
+                    p_max[x] = v;
+                    p_max_tap[x] = t;
+                }
+            }
+        }
+    }
+
+    //kept taps only over dirty pixels (added taps are already applied)
+    for(int d = 0; d < (int)dirty_min.size(); d++){
+        int p = dirty_min[d];
+        int y = p / cols;
+        int x = p % cols;
+        for(int k = 0; k < (int)kept.size(); k++){
+            int sy = y + kept[k]/len - radius;
+            int sx = x + kept[k]%len - radius;
+            if(sy < 0 || sy >= rows || sx < 0 || sx >= cols)
+                continue;
+            if(img[sy][sx] < c_min[p]){
+                c_min[p] = img[sy][sx];
+                c_min_tap[p] = kept[k];
+            }
+        }
+    }
+    for(int d = 0; d < (int)dirty_max.size(); d++){
+        int p = dirty_max[d];
+        int y = p / cols;
+        int x = p % cols;
+        for(int k = 0; k < (int)kept.size(); k++){
+            int sy = y + kept[k]/len - radius;
+            int sx = x + kept[k]%len - radius;
+            if(sy < 0 || sy >= rows || sx < 0 || sx >= cols)
+                continue;
+            if(img[sy][sx] > c_max[p]){
+                c_max[p] = img[sy][sx];
+                c_max_tap[p] = kept[k];
+            }
+        }
+    }
+}
+
+/*erosion and dilation with candidate strel into rows x cols matrices (either can be nullptr)*/
+void MorphDeltaCache::evaluate(int **strel, int **eroded, int **dilated) const{
+    vector<int> c_min, c_max;
+    vector<short> c_min_tap, c_max_tap;
+    deltaPlanes(strel, c_min, c_max, c_min_tap, c_max_tap);
+
+    for(int y = 0; y < rows; y++){
+        for(int x = 0; x < cols; x++){
+            if(eroded != nullptr)
+                eroded[y][x] = c_min[(size_t)y*cols + x];
+            if(dilated != nullptr)
+                dilated[y][x] = c_max[(size_t)y*cols + x];
+        }
+    }
+}
+
+/*make strel the incumbent*/
+void MorphDeltaCache::rebase(int **strel){
+    vector<int> c_min, c_max;
+    vector<short> c_min_tap, c_max_tap;
+    deltaPlanes(strel, c_min, c_max, c_min_tap, c_max_tap);
+
+    min_plane.swap(c_min);
+    max_plane.swap(c_max);
+    min_tap.swap(c_min_tap);
+    max_tap.swap(c_max_tap);
+
+    int len = 2*radius+1;
+    for(int t = 0; t < len*len; t++){
+        active[t] = strel[t/len][t%len] != 0;
+    }
+}
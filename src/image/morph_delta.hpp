@@ -0,0 +1,56 @@
+/*Delta erosion / dilation for binary structuring elements
+    *caches min and max of an image over an incumbent strel, with the tap that produced them
+    *a candidate strel is evaluated from the cache and only its added and removed taps
+
+    Biomedical Image Processing
+    Edgar Aguilera Hernández
+    02/01/2025
+*/
+
+#ifndef MORPH_DELTA_HPP
+#define MORPH_DELTA_HPP
+
+#include <vector>
+
+using namespace std;
+
+/*erosion and dilation of one image with an incumbent binary strel (cells 0 or 1), same borders as morph_op
+    pixels whose winning tap is removed are recomputed over every tap of the candidate, the rest only read added taps
+*/
+class MorphDeltaCache{
+    private:
+        int **img;                  //not owned
+        int rows;
+        int cols;
+        int radius;
+        vector<char> active;        //incumbent taps, (2*radius+1)^2 row major
+        vector<int> min_plane;      //erosion
+        vector<int> max_plane;      //dilation
+        vector<short> min_tap;      //tap with the min value (-1: no tap below initial value)
+        vector<short> max_tap;
+
+        /*fill planes and winning taps for candidate strel starting from the cached ones*/
+        void deltaPlanes(int **strel, vector<int> &c_min, vector<int> &c_max, vector<short> &c_min_tap, vector<short> &c_max_tap) const;
+
+    public:
+        MorphDeltaCache(int **image, int n_rows, int n_cols, int **strel, int strel_radius);
+
+        /*true when every cell of strel is 0 or 1 (required by the cache)*/
+        static bool binaryStrel(int **strel, int strel_radius);
+
+        /*erosion and dilation with candidate strel into rows x cols matrices (either can be nullptr)*/
+        void evaluate(int **strel, int **eroded, int **dilated) const;
+
+        /*make strel the incumbent*/
+        void rebase(int **strel);
+
+        int getRows(){
+            return rows;
+        }
+
+        int getCols(){
+            return cols;
+        }
+};
+
+#endif
@@ -40,6 +40,26 @@ double** createDoubleMatrix(int rows, int cols, int fill_n){
     return matrix;
 }
 
+/*Free every row of a matrix allocated with createMatrix*/
+void freeMatrix(int** matrix, int rows){
+    if(matrix == nullptr)
+        return;
+    for(int i = 0; i < rows; i++){
+        delete[] matrix[i];
+    }
+    delete[] matrix;
+}
+
+/*Free every row of a matrix allocated with createDoubleMatrix*/
+void freeMatrix(double** matrix, int rows){
+    if(matrix == nullptr)
+        return;
+    for(int i = 0; i < rows; i++){
+        delete[] matrix[i];
+    }
+    delete[] matrix;
+}
+
 /*Copy image into new matrix*/
 int** copyImage(int **img, int rows, int cols){
     int **copy = createMatrix(rows, cols, 0);
@@ -266,4 +286,78 @@ int** black_hat(int **img, int **kernel, int rows, int cols, int k_radius, int**
 
     return result;
 
+}
+
+/*Thin white (255) elements of a binary image with Zhang-Suen algorithm, both sub-iterations evaluated over the previous state
+    max_steps > 0 limits the number of sub-iterations that change pixels; returns the number of sub-iterations that changed pixels
+*/
+int zhangSuenThinning(int **img, int rows, int cols, int max_steps){
+    int steps = 0;
+    bool change_flag = true;
+    //pixels removed in current sub-iteration
+    int **remove = createMatrix(rows, cols, 0);
+
+    while(change_flag && (max_steps <= 0 || steps < max_steps)){
+        change_flag = false;
+
+        for(int phase = 0; phase < 2 && (max_steps <= 0 || steps < max_steps); phase++){
+            bool phase_change = false;
+            /* order of window elements:
+                9 2 3
+                8 1 4
+                7 6 5
+            */
+            for(int i = 1; i < rows - 1; i++){
+                for(int j = 1; j < cols - 1; j++){
+                    remove[i][j] = 0;
+                    if(img[i][j] != 255)
+                        continue;
+
+                    int p[9] = {img[i-1][j], img[i-1][j+1], img[i][j+1], img[i+1][j+1], img[i+1][j], img[i+1][j-1], img[i][j-1], img[i-1][j-1], img[i-1][j]};
+
+                    //1. Count number of white neighbour pixels
+                    int count_b = 0;
+                    for(int k = 0; k < 8; k++){
+                        if(p[k] == 255)
+                            count_b++;
+                    }
+                    if(count_b < 2 || count_b > 6)
+                        continue;
+
+                    //2. Count number of black -> white transitions (closing circle in window 2,3,...,2)
+                    int count_a = 0;
+                    for(int k = 0; k < 8; k++){
+                        if(p[k] == 0 && p[k+1] == 255)
+                            count_a++;
+                    }
+                    if(count_a != 1)
+                        continue;
+
+                    //3. and 4. phase 1: 2,4,6 and 4,6,8 with a black pixel; phase 2: 2,4,8 and 2,6,8
+                    if(phase == 0 && (p[0]*p[2]*p[4] != 0 || p[2]*p[4]*p[6] != 0))
+                        continue;
+                    if(phase == 1 && (p[0]*p[2]*p[6] != 0 || p[0]*p[4]*p[6] != 0))
+                        continue;
+
+                    remove[i][j] = 1;
+                    phase_change = true;
+                }
+            }
+
+            //apply removals after evaluating the whole image
+            if(phase_change){
+                for(int i = 1; i < rows - 1; i++){
+                    for(int j = 1; j < cols - 1; j++){
+                        if(remove[i][j])
+                            img[i][j] = 0;
+                    }
+                }
+                change_flag = true;
+                steps++;
+            }
+        }
+    }
+
+    freeMatrix(remove, rows);
+    return steps;
 }
\ No newline at end of file
@@ -21,6 +21,12 @@ int** createMatrix(int rows, int cols, int fill_n);
 /*Allocate a double row*column matrix initiallized at value */
 double** createDoubleMatrix(int rows, int cols, int fill_n);
 
+/*Free every row of a matrix allocated with createMatrix*/
+void freeMatrix(int** matrix, int rows);
+
+/*Free every row of a matrix allocated with createDoubleMatrix*/
+void freeMatrix(double** matrix, int rows);
+
 /*create a flat structuring element of specified shape and size
     allowed shapes: square, cross, disk, line, diamond
 */
@@ -51,4 +57,9 @@ int** gradient(int **img, int **kernel, int rows, int cols, int k_radius, int**
 int** top_hat(int **img, int **kernel, int rows, int cols, int k_radius, int** mask = nullptr);
 
 /*black-hat morphological operation*/
-int** black_hat(int **img, int **kernel, int rows, int cols, int k_radius, int** mask = nullptr);
\ No newline at end of file
+int** black_hat(int **img, int **kernel, int rows, int cols, int k_radius, int** mask = nullptr);
+
+/*Thin white (255) elements of a binary image with Zhang-Suen algorithm, both sub-iterations evaluated over the previous state
+    max_steps > 0 limits the number of sub-iterations that change pixels; returns the number of sub-iterations that changed pixels
+*/
+int zhangSuenThinning(int **img, int rows, int cols, int max_steps = 0);
\ No newline at end of file
@@ -0,0 +1,101 @@
+/*Multithreading helpers
+    *parallel for over row ranges
+    *shared task queue for independent tasks of uneven cost
+    *reusable barrier for workers that run several phases
+
+    Biomedical Image Processing
+    Edgar Aguilera Hernández
+    02/01/2025
+*/
+
+#include <thread>
+#include <atomic>
+#include <vector>
+#include <functional>
+#include "parallel.hpp"
+
+using namespace std;
+
+/*number of worker threads available (at least 1)*/
+int hardwareThreads(){
+    int n = (int)thread::hardware_concurrency();
+    if(n < 1)
+        n = 1;
+    return n;
+}
+
+/*split [begin, end) into contiguous chunks and run body(chunk_begin, chunk_end) on each one in its own thread
+    n_threads = 0 uses every hardware thread
+*/
+void parallelFor(int begin, int end, const function<void(int,int)> &body, int n_threads){
+    int n = end - begin;
+    if(n <= 0)
+        return;
+
+    if(n_threads <= 0)
+        n_threads = hardwareThreads();
+    if(n_threads > n)
+        n_threads = n;
+
+    //single chunk runs in calling thread
+    if(n_threads == 1){
+        body(begin, end);
+        return;
+    }
+
+    vector<thread> workers;
+    int chunk = (n + n_threads - 1) / n_threads;
+    for(int t = 0; t < n_threads; t++){
+        int c_begin = begin + t*chunk;
+        int c_end = c_begin + chunk;
+        if(c_end > end)
+            c_end = end;
+        if(c_begin >= c_end)
+            break;
+        workers.push_back(thread(body, c_begin, c_end));
+    }
+    for(int t = 0; t < (int)workers.size(); t++){
+        workers[t].join();
+    }
+}
+
+/*run task(0) ... task(n_tasks-1), every worker takes the next pending task when it finishes the previous one
+    n_threads = 0 uses every hardware thread
+*/
+void parallelTasks(int n_tasks, const function<void(int)> &task, int n_threads){
+    if(n_tasks <= 0)
+        return;
+
+    if(n_threads <= 0)
+        n_threads = hardwareThreads();
+    if(n_threads > n_tasks)
+        n_threads = n_tasks;
+
+    //one worker per chunk, tasks handed out from a shared counter
+    atomic<int> next_task(0);
+    parallelFor(0, n_threads, [&](int, int){
+        int t;
+        while((t = next_task++) < n_tasks){
+            task(t);
+        }
+    }, n_threads);
+}
+
+Barrier::Barrier(int n_threads){
+    this->n_threads = n_threads;
+    waiting = 0;
+    generation = 0;
+}
+
+/*block until every worker has reached the barrier*/
+void Barrier::wait(){
+    unique_lock<mutex> guard(lock);
+    long long current = generation;
+    if(++waiting == n_threads){
+        waiting = 0;
+        generation++;
+        released.notify_all();
+        return;
+    }
+    released.wait(guard, [&](){ return generation != current; });
+}
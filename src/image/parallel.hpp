@@ -0,0 +1,48 @@
+/*Multithreading helpers
+    *parallel for over row ranges
+    *shared task queue for independent tasks of uneven cost
+    *reusable barrier for workers that run several phases
+
+    Biomedical Image Processing
+    Edgar Aguilera Hernández
+    02/01/2025
+*/
+
+#ifndef PARALLEL_HPP
+#define PARALLEL_HPP
+
+#include <functional>
+#include <mutex>
+#include <condition_variable>
+
+using namespace std;
+
+/*number of worker threads available (at least 1)*/
+int hardwareThreads();
+
+/*split [begin, end) into contiguous chunks and run body(chunk_begin, chunk_end) on each one in its own thread
+    n_threads = 0 uses every hardware thread
+*/
+void parallelFor(int begin, int end, const function<void(int,int)> &body, int n_threads = 0);
+
+/*run task(0) ... task(n_tasks-1), every worker takes the next pending task when it finishes the previous one
+    n_threads = 0 uses every hardware thread
+*/
+void parallelTasks(int n_tasks, const function<void(int)> &task, int n_threads = 0);
+
+/*reusable barrier, wait() returns once n_threads workers are waiting (phases of one parallel solve without new threads)*/
+class Barrier{
+    private:
+        mutex lock;
+        condition_variable released;
+        int n_threads;
+        int waiting;
+        long long generation;
+
+    public:
+        Barrier(int n_threads);
+
+        void wait();
+};
+
+#endif
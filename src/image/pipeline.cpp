@@ -0,0 +1,284 @@
+/*Row streaming pipeline for chained local operators
+    *every node produces one row at a time from a window of 2*radius+1 upstream rows
+    *intermediate rows live in small ring buffers sized from the consumer radius
+    *nodes: source, convolution (gauss), scharr magnitude, flat erosion/dilation, pointwise combine, invert
+
+    Biomedical Image Processing
+    Edgar Aguilera Hernández
+    02/01/2025
+*/
+
+#include <vector>
+#include <cmath>
+#include <algorithm>
+#include "pipeline.hpp"
+#include "morph_op.hpp"
+
+using namespace std;
+
+//------------------------------------------RowNode
+RowNode::RowNode(int n_rows, int n_cols){
+    rows = n_rows;
+    cols = n_cols;
+    capacity = 1;
+    support_rows = 0;
+    ring.assign(cols, 0);
+    ring_y.assign(1, -1);
+}
+
+/*make room for a consumer reading windows of 2*radius+1 rows*/
+void RowNode::reserve(int radius){
+    if(2*radius+1 <= capacity)
+        return;
+    capacity = 2*radius+1;
+    ring.assign((size_t)capacity*cols, 0);
+    ring_y.assign(capacity, -1);
+}
+
+/*get output row y, computing it if it is not in the ring buffer (nullptr outside image)*/
+const int* RowNode::row(int y){
+    if(y < 0 || y >= rows)
+        return nullptr;
+
+    int slot = y % capacity;
+    int *out = &ring[(size_t)slot*cols];
+    if(ring_y[slot] != y){
+        computeRow(y, out);
+        ring_y[slot] = y;
+    }
+    return out;
+}
+
+/*gather rows y-radius..y+radius of upstream (nullptr outside image)*/
+void RowNode::window(RowNode *upstream, int y, int radius, const int **rows_out){
+    for(int k = 0; k < 2*radius+1; k++){
+        rows_out[k] = upstream->row(y - radius + k);
+    }
+}
+
+//------------------------------------------SourceNode
+SourceNode::SourceNode(int **image, int n_rows, int n_cols) : RowNode(n_rows, n_cols){
+    img = image;
+}
+
+const int* SourceNode::row(int y){
+    if(y < 0 || y >= rows)
+        return nullptr;
+    return img[y];
+}
+
+//------------------------------------------ConvolutionNode
+ConvolutionNode::ConvolutionNode(RowNode *up, int **k, int k_radius, int div) : RowNode(up->getRows(), up->getCols()){
+    upstream = up;
+    radius = k_radius;
+    div_c = (div == 0) ? 1 : div;
+    int len = 2*radius+1;
+    if(k != nullptr){
+        for(int i = 0; i < len; i++){
+            for(int j = 0; j < len; j++){
+                kernel.push_back(k[i][j]);
+            }
+        }
+    }
+    acc.assign(cols, 0);
+    win.assign(2*radius+1, nullptr);
+    support_rows = upstream->support() + radius;
+    upstream->reserve(radius);
+}
+
+void ConvolutionNode::computeRow(int y, int *out){
+    int len = 2*radius+1;
+    window(upstream, y, radius, win.data());
+
+    for(int x = 0; x < cols; x++){
+        acc[x] = 0;
+    }
+
+    //one tap at a time over the whole row, skipping out of image taps
+    for(int i = 0; i < len; i++){
+        if(win[i] == nullptr)
+            continue;
+        for(int j = 0; j < len; j++){
+            int w = kernel[i*len + j];
+            if(w == 0)
+                continue;
+            int shift = j - radius;
+            int x_begin = shift < 0 ? -shift : 0;
+            int x_end = shift > 0 ? cols - shift : cols;
+            const int *src = win[i] + shift;
+            for(int x = x_begin; x < x_end; x++){
+                acc[x] += (long)src[x] * w;
+            }
+        }
+    }
+
+    for(int x = 0; x < cols; x++){
+        out[x] = (int)(acc[x] / div_c);
+    }
+}
+
+//------------------------------------------GaussNode
+GaussNode::GaussNode(RowNode *up) : ConvolutionNode(up, nullptr, 2, 273){
+    int gauss[25] = {1,4,7,4,1,
+                     4,16,26,16,4,
+                     7,26,41,26,7,
+                     4,16,26,16,4,
+                     1,4,7,4,1};
+    kernel.assign(gauss, gauss + 25);
+}
+
+//------------------------------------------ScharrNode
+ScharrNode::ScharrNode(RowNode *up) : RowNode(up->getRows(), up->getCols()){
+    upstream = up;
+    support_rows = upstream->support() + 1;
+    upstream->reserve(1);
+}
+
+void ScharrNode::computeRow(int y, int *out){
+    const int *win[3];
+    window(upstream, y, 1, win);
+    const int *top = win[0];
+    const int *mid = win[1];
+    const int *bottom = win[2];
+
+    for(int x = 0; x < cols; x++){
+        int xl = x-1, xr = x+1;
+        int tl = (top && xl >= 0) ? top[xl] : 0;
+        int tc = top ? top[x] : 0;
+        int tr = (top && xr < cols) ? top[xr] : 0;
+        int ml = (xl >= 0) ? mid[xl] : 0;
+        int mr = (xr < cols) ? mid[xr] : 0;
+        int bl = (bottom && xl >= 0) ? bottom[xl] : 0;
+        int bc = bottom ? bottom[x] : 0;
+        int br = (bottom && xr < cols) ? bottom[xr] : 0;
+
+        int gx = 3*(tl - tr) + 10*(ml - mr) + 3*(bl - br);
+        int gy = 3*(tl - bl) + 10*(tc - bc) + 3*(tr - br);
+        out[x] = (int)(sqrt(gx*gx + gy*gy));
+    }
+}
+
+//------------------------------------------MorphNode
+MorphNode::MorphNode(RowNode *up, int **strel, int strel_radius, int morph_op, int **m) : RowNode(up->getRows(), up->getCols()){
+    upstream = up;
+    radius = strel_radius;
+    op = morph_op;
+    mask = m;
+
+    //operate only over structuring element
+    for(int k = 0; k < 2*radius+1; k++){
+        for(int l = 0; l < 2*radius+1; l++){
+            if(strel[k][l] != 0){
+                tap_k.push_back(k);
+                tap_l.push_back(l);
+                tap_w.push_back(strel[k][l]);
+            }
+        }
+    }
+    win.assign(2*radius+1, nullptr);
+    support_rows = upstream->support() + radius;
+    upstream->reserve(radius);
+}
+
+void MorphNode::computeRow(int y, int *out){
+    window(upstream, y, radius, win.data());
+
+    //dilation starts at lowest value, erosion at highest
+    int init = (op == MORPH_DILATION) ? 0 : 255;
+    for(int x = 0; x < cols; x++){
+        out[x] = init;
+    }
+
+    //one shifted row per tap, max/min over the whole row
+    for(int t = 0; t < (int)tap_k.size(); t++){
+        const int *src_row = win[tap_k[t]];
+        if(src_row == nullptr)
+            continue;
+        int w = tap_w[t];
+        int shift = tap_l[t] - radius;
+        int x_begin = shift < 0 ? -shift : 0;
+        int x_end = shift > 0 ? cols - shift : cols;
+        const int *src = src_row + shift;
+
+        if(op == MORPH_DILATION){
+            for(int x = x_begin; x < x_end; x++){
+                int v = src[x]*w;
+                out[x] = v > out[x] ? v : out[x];
+            }
+        }else{
+            for(int x = x_begin; x < x_end; x++){
+                int v = src[x]*w;
+                out[x] = v < out[x] ? v : out[x];
+            }
+        }
+    }
+
+    //pixels outside mask keep initial value
+    if(mask != nullptr){
+        for(int x = 0; x < cols; x++){
+            if(mask[y][x] == 0)
+                out[x] = init;
+        }
+    }
+}
+
+//------------------------------------------CombineNode
+CombineNode::CombineNode(RowNode *node_a, RowNode *node_b, int combine_op) : RowNode(node_a->getRows(), node_a->getCols()){
+    a = node_a;
+    b = node_b;
+    op = combine_op;
+    support_rows = max(a->support(), b->support());
+    a->reserve(0);
+    b->reserve(0);
+}
+
+void CombineNode::computeRow(int y, int *out){
+    //copy first operand before pulling the second one
+    const int *row_a = a->row(y);
+    for(int x = 0; x < cols; x++){
+        out[x] = row_a[x];
+    }
+    const int *row_b = b->row(y);
+
+    if(op == COMBINE_ADD){
+        for(int x = 0; x < cols; x++){
+            int v = out[x] + row_b[x];
+            out[x] = v > 255 ? 255 : v;
+        }
+    }else{
+        for(int x = 0; x < cols; x++){
+            int v = out[x] - row_b[x];
+            out[x] = v < 0 ? 0 : v;
+        }
+    }
+}
+
+//------------------------------------------InvertNode
+InvertNode::InvertNode(RowNode *up, int **m) : RowNode(up->getRows(), up->getCols()){
+    upstream = up;
+    mask = m;
+    support_rows = upstream->support();
+    upstream->reserve(0);
+}
+
+void InvertNode::computeRow(int y, int *out){
+    const int *src = upstream->row(y);
+    for(int x = 0; x < cols; x++){
+        if(mask != nullptr && mask[y][x] == 0)
+            out[x] = 0;
+        else
+            out[x] = 255 - src[x];
+    }
+}
+
+/*pull every row of node into a new rows x cols matrix*/
+int** runPipeline(RowNode *node){
+    int **result = createMatrix(node->getRows(), node->getCols(), 0);
+    for(int y = 0; y < node->getRows(); y++){
+        const int *src = node->row(y);
+        for(int x = 0; x < node->getCols(); x++){
+            result[y][x] = src[x];
+        }
+    }
+    return result;
+}
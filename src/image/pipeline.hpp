@@ -0,0 +1,164 @@
+/*Row streaming pipeline for chained local operators
+    *every node produces one row at a time from a window of 2*radius+1 upstream rows
+    *intermediate rows live in small ring buffers sized from the consumer radius
+    *nodes: source, convolution (gauss), scharr magnitude, flat erosion/dilation, pointwise combine, invert
+
+    Biomedical Image Processing
+    Edgar Aguilera Hernández
+    02/01/2025
+*/
+
+#ifndef PIPELINE_HPP
+#define PIPELINE_HPP
+
+#include <vector>
+
+using namespace std;
+
+/*pointwise operations for CombineNode*/
+const int COMBINE_ADD = 1;      //a + b, clamped to 255
+const int COMBINE_DIFF = 2;     //a - b, clamped to 0
+
+/*flat morphological operations for MorphNode (same codes as morph_op convolution)*/
+const int MORPH_DILATION = 1;
+const int MORPH_EROSION = 2;
+
+/*node of a row streaming pipeline*/
+class RowNode{
+    protected:
+        int rows;
+        int cols;
+        int capacity;           //rows kept in ring buffer
+        int support_rows;       //rows of source image needed above and below an output row
+        vector<int> ring;
+        vector<int> ring_y;     //image row stored in each ring slot
+
+        /*compute output row y into out (cols values)*/
+        virtual void computeRow(int y, int *out) = 0;
+
+        /*gather rows y-radius..y+radius of upstream (nullptr outside image)*/
+        void window(RowNode *upstream, int y, int radius, const int **rows_out);
+
+    public:
+        RowNode(int n_rows, int n_cols);
+        virtual ~RowNode(){}
+
+        /*get output row y, computing it if it is not in the ring buffer (nullptr outside image)*/
+        virtual const int* row(int y);
+
+        /*make room for a consumer reading windows of 2*radius+1 rows*/
+        void reserve(int radius);
+
+        /*vertical support of the whole chain ending at this node (halo needed to process tiles)*/
+        int support(){
+            return support_rows;
+        }
+
+        int getRows(){
+            return rows;
+        }
+
+        int getCols(){
+            return cols;
+        }
+};
+
+/*image already in memory, rows are returned without copies*/
+class SourceNode : public RowNode{
+    private:
+        int **img;
+
+    protected:
+        void computeRow(int, int *){}
+
+    public:
+        SourceNode(int **image, int n_rows, int n_cols);
+        const int* row(int y);
+};
+
+/*weighted sum over a square kernel divided by div_c, out of image pixels are skipped*/
+class ConvolutionNode : public RowNode{
+    private:
+        RowNode *upstream;
+        int radius;
+        int div_c;
+        vector<long> acc;
+        vector<const int*> win;     //upstream rows of the current window
+
+    protected:
+        vector<int> kernel;     //(2*radius+1)^2 weights
+
+        void computeRow(int y, int *out);
+
+    public:
+        ConvolutionNode(RowNode *up, int **k, int k_radius, int div);
+};
+
+/*5x5 gaussian smoothing, same kernel as Image::gauss_filter*/
+class GaussNode : public ConvolutionNode{
+    public:
+        GaussNode(RowNode *up);
+};
+
+/*Scharr gradient magnitude, out of image pixels count as zero*/
+class ScharrNode : public RowNode{
+    private:
+        RowNode *upstream;
+
+    protected:
+        void computeRow(int y, int *out);
+
+    public:
+        ScharrNode(RowNode *up);
+};
+
+/*flat erosion or dilation with a structuring element, same result as morph_op erosion/dilation*/
+class MorphNode : public RowNode{
+    private:
+        RowNode *upstream;
+        int radius;
+        int op;
+        int **mask;
+        vector<int> tap_k;      //strel row of each non zero tap
+        vector<int> tap_l;      //strel column of each non zero tap
+        vector<int> tap_w;      //strel weight
+        vector<const int*> win; //upstream rows of the current window
+
+    protected:
+        void computeRow(int y, int *out);
+
+    public:
+        MorphNode(RowNode *up, int **strel, int strel_radius, int morph_op, int **m = nullptr);
+};
+
+/*pointwise combination of two nodes (COMBINE_ADD, COMBINE_DIFF)*/
+class CombineNode : public RowNode{
+    private:
+        RowNode *a;
+        RowNode *b;
+        int op;
+
+    protected:
+        void computeRow(int y, int *out);
+
+    public:
+        CombineNode(RowNode *node_a, RowNode *node_b, int combine_op);
+};
+
+/*255 - value, pixels outside mask are set to 0*/
+class InvertNode : public RowNode{
+    private:
+        RowNode *upstream;
+        int **mask;
+
+    protected:
+        void computeRow(int y, int *out);
+
+    public:
+        InvertNode(RowNode *up, int **m = nullptr);
+};
+
+/*pull every row of node into a new rows x cols matrix*/
+int** runPipeline(RowNode *node);
+
+#endif
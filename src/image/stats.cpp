@@ -0,0 +1,278 @@
+/*Image statistics
+    *min, max, arg-max, sum, sum of squares, count and 256-bin histogram in a single sweep
+    *rank correlation between two sets of scores
+    *Student t quantiles
+
+    Biomedical Image Processing
+    Edgar Aguilera Hernández
+    02/01/2025
+*/
+
+#include <climits>
+#include <cstdlib>
+#include <cmath>
+#include <vector>
+#include <algorithm>
+#include "stats.hpp"
+
+using namespace std;
+
+/*mean value truncated as an int*/
+int ImageStats::mean() const{
+    if(count == 0)
+        return 0;
+    return (int)(sum / count);
+}
+
+/*compute every statistic in one pass over pixels with mask != 0 (whole image if mask is nullptr)*/
+ImageStats imageStatistics(int **img, int rows, int cols, int **mask){
+    ImageStats stats;
+    int min = INT_MAX;
+    int max = INT_MIN;
+
+    //4 interleaved histograms so consecutive equal pixels do not serialize on one counter
+    long long hist[4][256] = {{0}};
+
+    for(int i = 0; i < rows; i++){
+        const int *row = img[i];
+        const int *m_row = (mask != nullptr) ? mask[i] : nullptr;
+
+        //branchless row reductions so the compiler can vectorize them
+        int row_min = INT_MAX;
+        int row_max = INT_MIN;
+        long long row_sum = 0;
+        long long row_sum_sq = 0;
+        long long row_count = 0;
+        for(int j = 0; j < cols; j++){
+            int keep = (m_row == nullptr) || (m_row[j] != 0);
+            int v = row[j];
+            row_min = (keep && v < row_min) ? v : row_min;
+            row_max = (keep && v > row_max) ? v : row_max;
+            row_sum += keep ? v : 0;
+            row_sum_sq += keep ? (long long)v*v : 0;
+            row_count += keep;
+        }
+
+        //histogram
+        for(int j = 0; j < cols; j++){
+            if(m_row != nullptr && m_row[j] == 0)
+                continue;
+            int v = row[j];
+            v = v < 0 ? 0 : (v > 255 ? 255 : v);
+            hist[j & 3][v]++;
+        }
+
+        //first position of max only searched when row improves it
+        if(row_count > 0 && row_max > max){
+            max = row_max;
+            for(int j = 0; j < cols; j++){
+                if(row[j] == row_max && (m_row == nullptr || m_row[j] != 0)){
+                    stats.argmax_y = i;
+                    stats.argmax_x = j;
+                    break;
+                }
+            }
+        }
+        if(row_min < min)
+            min = row_min;
+
+        stats.sum += row_sum;
+        stats.sum_sq += row_sum_sq;
+        stats.count += row_count;
+    }
+
+    for(int b = 0; b < 256; b++){
+        stats.histogram[b] = hist[0][b] + hist[1][b] + hist[2][b] + hist[3][b];
+    }
+
+    if(stats.count > 0){
+        stats.min = min;
+        stats.max = max;
+    }
+    return stats;
+}
+
+/*iterative (Ridler-Calvard) threshold from a 256-bin histogram: midpoint of the means above and below,
+    repeated from the global mean until it moves at most one gray level
+*/
+int iterativeThreshold(const long long histogram[256]){
+    //prefix counts and sums: cum_n[v] / cum_s[v] cover values < v
+    long long cum_n[257] = {0};
+    long long cum_s[257] = {0};
+    for(int v = 0; v < 256; v++){
+        cum_n[v+1] = cum_n[v] + histogram[v];
+        cum_s[v+1] = cum_s[v] + histogram[v]*v;
+    }
+    if(cum_n[256] == 0)
+        return 0;
+
+    //1. initial threshold from mean
+    int threshold = 0;
+    int threshold_new = (int)(cum_s[256] / cum_n[256]);
+    int iterations = 0;
+
+    //at most one pass per gray level in case it oscillates
+    while(abs(threshold - threshold_new) > 1 && iterations < 256){
+        iterations++;
+        threshold = threshold_new;
+
+        //2. foreground (> threshold) and background (< threshold) means in O(1)
+        long long n_back = cum_n[threshold];
+        long long s_back = cum_s[threshold];
+        long long n_fore = cum_n[256] - cum_n[threshold+1];
+        long long s_fore = cum_s[256] - cum_s[threshold+1];
+        int mean_back = n_back > 0 ? (int)(s_back / n_back) : 0;
+        int mean_fore = n_fore > 0 ? (int)(s_fore / n_fore) : 0;
+
+        //3. new threshold between both means
+        threshold_new = (mean_fore + mean_back) / 2;
+    }
+
+    return threshold_new;
+}
+
+/*Otsu threshold from a 256-bin histogram: level maximizing between class variance (class 1: values > threshold)*/
+int otsuThreshold(const long long histogram[256]){
+    double total = 0, total_sum = 0;
+    for(int v = 0; v < 256; v++){
+        total += histogram[v];
+        total_sum += (double)histogram[v]*v;
+    }
+    if(total == 0)
+        return 0;
+
+    double n_back = 0, s_back = 0;
+    double best_var = -1;
+    int best_t = 0;
+
+    //class 0: values <= t, class 1: values > t
+    for(int t = 0; t < 255; t++){
+        n_back += histogram[t];
+        s_back += (double)histogram[t]*t;
+        double n_fore = total - n_back;
+        if(n_back == 0 || n_fore == 0)
+            continue;
+
+        double mean_back = s_back / n_back;
+        double mean_fore = (total_sum - s_back) / n_fore;
+        double between = n_back * n_fore * (mean_back - mean_fore) * (mean_back - mean_fore);
+        if(between > best_var){
+            best_var = between;
+            best_t = t;
+        }
+    }
+
+    return best_t;
+}
+
+/*ranks starting at 1, tied values share their average rank*/
+static vector<double> averageRanks(const vector<double> &values){
+    int n = values.size();
+    vector<int> order(n);
+    for(int i = 0; i < n; i++){
+        order[i] = i;
+    }
+    sort(order.begin(), order.end(), [&values](int a, int b){
+        return values[a] < values[b];
+    });
+
+    vector<double> ranks(n);
+    for(int i = 0; i < n; ){
+        int j = i;
+        while(j + 1 < n && values[order[j+1]] == values[order[i]])
+            j++;
+        for(int k = i; k <= j; k++){
+            ranks[order[k]] = (i + j)/2.0 + 1;
+        }
+        i = j + 1;
+    }
+    return ranks;
+}
+
+/*Spearman rank correlation of two score lists of the same size (ties get their average rank), 0 when undefined*/
+double spearmanCorrelation(const vector<double> &a, const vector<double> &b){
+    int n = a.size();
+    if(n < 2 || (int)b.size() != n)
+        return 0;
+
+    //Pearson correlation of the ranks
+    vector<double> rank_a = averageRanks(a);
+    vector<double> rank_b = averageRanks(b);
+    double mean = (n + 1)/2.0;
+    double cov = 0, var_a = 0, var_b = 0;
+    for(int i = 0; i < n; i++){
+        cov += (rank_a[i] - mean)*(rank_b[i] - mean);
+        var_a += (rank_a[i] - mean)*(rank_a[i] - mean);
+        var_b += (rank_b[i] - mean)*(rank_b[i] - mean);
+    }
+    if(var_a == 0 || var_b == 0)
+        return 0;
+    return cov / sqrt(var_a*var_b);
+}
+
+/*continued fraction of the incomplete beta function (modified Lentz)*/
+static double betaContinuedFraction(double a, double b, double x){
+    const double tiny = 1e-300;
+    double c = 1;
+    double d = 1 - (a + b)*x/(a + 1);
+    d = (fabs(d) < tiny) ? 1/tiny : 1/d;
+    double h = d;
+    for(int m = 1; m <= 300; m++){
+        //even step
+        double num = m*(b - m)*x/((a + 2*m - 1)*(a + 2*m));
+        d = 1 + num*d;
+        d = (fabs(d) < tiny) ? 1/tiny : 1/d;
+        c = 1 + num/c;
+        c = (fabs(c) < tiny) ? tiny : c;
+        h *= d*c;
+
+        //odd step
+        num = -(a + m)*(a + b + m)*x/((a + 2*m)*(a + 2*m + 1));
+        d = 1 + num*d;
+        d = (fabs(d) < tiny) ? 1/tiny : 1/d;
+        c = 1 + num/c;
+        c = (fabs(c) < tiny) ? tiny : c;
+        double delta = d*c;
+        h *= delta;
+        if(fabs(delta - 1) < 1e-12)
+            break;
+    }
+    return h;
+}
+
+/*regularized incomplete beta function I_x(a, b)*/
+static double regularizedBeta(double a, double b, double x){
+    if(x <= 0)
+        return 0;
+    if(x >= 1)
+        return 1;
+    double front = exp(lgamma(a + b) - lgamma(a) - lgamma(b) + a*log(x) + b*log(1 - x));
+    if(x < (a + 1)/(a + b + 2))
+        return front*betaContinuedFraction(a, b, x)/a;
+    return 1 - front*betaContinuedFraction(b, a, 1 - x)/b;
+}
+
+/*quantile p (0 < p < 1) of the Student t distribution with df degrees of freedom*/
+double studentTQuantile(double p, int df){
+    if(df < 1 || p <= 0 || p >= 1)
+        return NAN;
+    if(p < 0.5)
+        return -studentTQuantile(1 - p, df);
+
+    //upper tail P(T > t) = I_x(df/2, 1/2) / 2 with x = df / (df + t^2), decreasing in t
+    auto upperTail = [df](double t){
+        return 0.5*regularizedBeta(df/2.0, 0.5, df/(df + t*t));
+    };
+    double q = 1 - p;
+    double low = 0, high = 1;
+    while(upperTail(high) > q && high < 1e12)
+        high *= 2;
+    for(int k = 0; k < 200 && high - low > 1e-10*high; k++){
+        double mid = (low + high)/2;
+        if(upperTail(mid) > q)
+            low = mid;
+        else
+            high = mid;
+    }
+    return (low + high)/2;
+}
@@ -0,0 +1,50 @@
+/*Image statistics
+    *min, max, arg-max, sum, sum of squares, count and 256-bin histogram in a single sweep
+    *rank correlation between two sets of scores
+    *Student t quantiles
+
+    Biomedical Image Processing
+    Edgar Aguilera Hernández
+    02/01/2025
+*/
+
+#ifndef STATS_HPP
+#define STATS_HPP
+
+#include <vector>
+
+using namespace std;
+
+/*statistics over the pixels inside a mask (or the whole image)*/
+struct ImageStats{
+    int min = 0;
+    int max = 0;
+    int argmax_y = -1;      //first (row-major) pixel holding max value
+    int argmax_x = -1;
+    long long sum = 0;
+    long long sum_sq = 0;
+    long long count = 0;
+    long long histogram[256] = {0};    //values clamped into 0-255
+
+    /*mean value truncated as an int*/
+    int mean() const;
+};
+
+/*compute every statistic in one pass over pixels with mask != 0 (whole image if mask is nullptr)*/
+ImageStats imageStatistics(int **img, int rows, int cols, int **mask = nullptr);
+
+/*iterative (Ridler-Calvard) threshold from a 256-bin histogram: midpoint of the means above and below,
+    repeated from the global mean until it moves at most one gray level
+*/
+int iterativeThreshold(const long long histogram[256]);
+
+/*Otsu threshold from a 256-bin histogram: level maximizing between class variance (class 1: values > threshold)*/
+int otsuThreshold(const long long histogram[256]);
+
+/*Spearman rank correlation of two score lists of the same size (ties get their average rank), 0 when undefined*/
+double spearmanCorrelation(const vector<double> &a, const vector<double> &b);
+
+/*quantile p (0 < p < 1) of the Student t distribution with df degrees of freedom*/
+double studentTQuantile(double p, int df);
+
+#endif
@@ -0,0 +1,465 @@
+/*Threshold surface interpolation
+    *laplace equation with fixed interpolation points (Dirichlet) and zero flux image borders
+    *float multigrid V-cycles with red-black Gauss-Seidel smoothing
+    *float red-black successive over-relaxation, in place and split across threads
+    *coarse grid mode: sample points pooled into factor x factor cells, coarse surface upsampled
+
+    Biomedical Image Processing
+    Edgar Aguilera Hernández
+    02/01/2025
+*/
+
+#include <vector>
+#include <cmath>
+#include <algorithm>
+#include "surface.hpp"
+#include "morph_op.hpp"
+#include "parallel.hpp"
+
+using namespace std;
+
+/*one level of the multigrid hierarchy, h2 is the squared grid spacing relative to the image*/
+struct GridLevel{
+    int rows;
+    int cols;
+    float h2;
+    vector<float> u;        //solution (finest) or correction (coarser levels)
+    vector<float> f;        //right hand side
+    vector<float> r;        //residual
+    vector<char> fixed;     //fixed points, u is never updated there
+};
+
+/*sum of in-image 4-neighbours of (y, x) and how many there are (zero flux borders)*/
+static inline float neighbourSum(const GridLevel &g, int y, int x, int &n){
+    const float *u = g.u.data();
+    size_t p = (size_t)y*g.cols + x;
+    float sum = 0;
+    n = 0;
+    if(y > 0){ sum += u[p - g.cols]; n++; }
+    if(y < g.rows-1){ sum += u[p + g.cols]; n++; }
+    if(x > 0){ sum += u[p - 1]; n++; }
+    if(x < g.cols-1){ sum += u[p + 1]; n++; }
+    return sum;
+}
+
+/*red-black Gauss-Seidel sweeps over free pixels*/
+static void smoothRedBlack(GridLevel &g, int sweeps){
+    for(int s = 0; s < sweeps; s++){
+        for(int colour = 0; colour < 2; colour++){
+            for(int y = 0; y < g.rows; y++){
+                for(int x = (y + colour) % 2; x < g.cols; x += 2){
+                    size_t p = (size_t)y*g.cols + x;
+                    if(g.fixed[p])
+                        continue;
+                    int n;
+                    float sum = neighbourSum(g, y, x, n);
+                    if(n > 0)
+                        g.u[p] = (sum - g.h2*g.f[p]) / n;
+                }
+            }
+        }
+    }
+}
+
+/*r = f - laplace(u) at free pixels, returning max |residual| scaled by h2 (gray levels)*/
+static double computeResidual(GridLevel &g){
+    double max_residual = 0;
+    for(int y = 0; y < g.rows; y++){
+        for(int x = 0; x < g.cols; x++){
+            size_t p = (size_t)y*g.cols + x;
+            if(g.fixed[p]){
+                g.r[p] = 0;
+                continue;
+            }
+            int n;
+            float sum = neighbourSum(g, y, x, n);
+            g.r[p] = g.f[p] - (sum - n*g.u[p]) / g.h2;
+            max_residual = max(max_residual, (double)fabs(g.r[p]*g.h2));
+        }
+    }
+    return max_residual;
+}
+
+/*coarse level of fine: a cell is fixed when any of its 2x2 children is fixed (zero correction there)*/
+static GridLevel coarsen(const GridLevel &fine){
+    GridLevel coarse;
+    coarse.rows = (fine.rows + 1)/2;
+    coarse.cols = (fine.cols + 1)/2;
+    coarse.h2 = fine.h2*4;
+    size_t size = (size_t)coarse.rows*coarse.cols;
+    coarse.u.assign(size, 0);
+    coarse.f.assign(size, 0);
+    coarse.r.assign(size, 0);
+    coarse.fixed.assign(size, 0);
+    for(int y = 0; y < fine.rows; y++){
+        for(int x = 0; x < fine.cols; x++){
+            if(fine.fixed[(size_t)y*fine.cols + x])
+                coarse.fixed[(size_t)(y/2)*coarse.cols + x/2] = 1;
+        }
+    }
+    return coarse;
+}
+
+/*coarse right hand side: mean residual of the free children, zero initial correction*/
+static void restrictResidual(const GridLevel &fine, GridLevel &coarse){
+    fill(coarse.u.begin(), coarse.u.end(), 0);
+    fill(coarse.f.begin(), coarse.f.end(), 0);
+    vector<int> count(coarse.f.size(), 0);
+    for(int y = 0; y < fine.rows; y++){
+        for(int x = 0; x < fine.cols; x++){
+            size_t p = (size_t)y*fine.cols + x;
+            if(fine.fixed[p])
+                continue;
+            size_t c = (size_t)(y/2)*coarse.cols + x/2;
+            coarse.f[c] += fine.r[p];
+            count[c]++;
+        }
+    }
+    for(size_t c = 0; c < coarse.f.size(); c++){
+        if(coarse.fixed[c] || count[c] == 0)
+            coarse.f[c] = 0;
+        else
+            coarse.f[c] /= count[c];
+    }
+}
+
+/*add bilinear interpolation of the coarse correction to free fine pixels*/
+static void prolongCorrection(const GridLevel &coarse, GridLevel &fine){
+    for(int y = 0; y < fine.rows; y++){
+        float c_y = min(max((y + 0.5f)/2 - 0.5f, 0.0f), (float)(coarse.rows-1));
+        int y0 = (int)c_y;
+        int y1 = min(y0+1, coarse.rows-1);
+        float wy = c_y - y0;
+        for(int x = 0; x < fine.cols; x++){
+            size_t p = (size_t)y*fine.cols + x;
+            if(fine.fixed[p])
+                continue;
+            float c_x = min(max((x + 0.5f)/2 - 0.5f, 0.0f), (float)(coarse.cols-1));
+            int x0 = (int)c_x;
+            int x1 = min(x0+1, coarse.cols-1);
+            float wx = c_x - x0;
+            const float *top = &coarse.u[(size_t)y0*coarse.cols];
+            const float *bottom = &coarse.u[(size_t)y1*coarse.cols];
+            float t = top[x0]*(1-wx) + top[x1]*wx;
+            float b = bottom[x0]*(1-wx) + bottom[x1]*wx;
+            fine.u[p] += t*(1-wy) + b*wy;
+        }
+    }
+}
+
+/*V-cycle from level l: pre smoothing, coarse correction, post smoothing*/
+static void vCycle(vector<GridLevel> &levels, int l){
+    const int pre_sweeps = 2;
+    const int post_sweeps = 2;
+    const int coarsest_sweeps = 50;
+
+    GridLevel &g = levels[l];
+    if(l == (int)levels.size()-1){
+        smoothRedBlack(g, coarsest_sweeps);
+        return;
+    }
+
+    smoothRedBlack(g, pre_sweeps);
+    computeResidual(g);
+    restrictResidual(g, levels[l+1]);
+    vCycle(levels, l+1);
+    prolongCorrection(levels[l+1], g);
+    smoothRedBlack(g, post_sweeps);
+}
+
+/*interpolate points (value != 0 is a fixed point) over a rows x cols surface with multigrid V-cycles
+    fixed points are kept at every level, stops when max |residual| <= eps or after max_cycles
+    returns the surface rounded to int (all zero without fixed points)
+*/
+int** multigridSurface(int **points, int rows, int cols, double eps, int max_cycles, SurfaceReport *report){
+    int** surface = createMatrix(rows, cols, 0);
+
+    //finest level, free pixels start at the mean of fixed points
+    GridLevel fine;
+    fine.rows = rows;
+    fine.cols = cols;
+    fine.h2 = 1;
+    size_t size = (size_t)rows*cols;
+    fine.u.assign(size, 0);
+    fine.f.assign(size, 0);
+    fine.r.assign(size, 0);
+    fine.fixed.assign(size, 0);
+    double sum = 0;
+    long long n_fixed = 0;
+    for(int y = 0; y < rows; y++){
+        for(int x = 0; x < cols; x++){
+            if(points[y][x] != 0){
+                fine.fixed[(size_t)y*cols + x] = 1;
+                fine.u[(size_t)y*cols + x] = points[y][x];
+                sum += points[y][x];
+                n_fixed++;
+            }
+        }
+    }
+    if(n_fixed == 0)
+        return surface;
+    for(size_t p = 0; p < size; p++){
+        if(!fine.fixed[p])
+            fine.u[p] = sum / n_fixed;
+    }
+
+    //coarser levels down to a few pixels per side
+    vector<GridLevel> levels;
+    levels.push_back(fine);
+    while(levels.back().rows > 4 && levels.back().cols > 4){
+        levels.push_back(coarsen(levels.back()));
+    }
+
+    double residual = computeResidual(levels[0]);
+    for(int cycle = 0; cycle < max_cycles && residual > eps; cycle++){
+        vCycle(levels, 0);
+        residual = computeResidual(levels[0]);
+        if(report != nullptr){
+            report->iterations++;
+            report->residuals.push_back(residual);
+        }
+    }
+
+    for(int y = 0; y < rows; y++){
+        for(int x = 0; x < cols; x++){
+            surface[y][x] = (int)lround(levels[0].u[(size_t)y*cols + x]);
+        }
+    }
+    return surface;
+}
+
+/*over-relaxation factor for a rows x cols laplace problem, 2 / (1 + sin(pi / max(rows, cols)))*/
+double optimalOmega(int rows, int cols){
+    return 2.0 / (1.0 + sin(M_PI / max(max(rows, cols), 2)));
+}
+
+/*interpolate points (value != 0 is a fixed point) over a rows x cols surface with red-black SOR
+    every colour is updated in place, its rows split across n_threads (0: every hardware thread)
+    omega <= 0 takes optimalOmega, stops when max |residual| <= eps or after max_sweeps
+    returns the surface rounded to int (all zero without fixed points)
+*/
+int** redBlackSORSurface(int **points, int rows, int cols, double omega, double eps, int max_sweeps, SurfaceReport *report, int n_threads){
+    int** surface = createMatrix(rows, cols, 0);
+    if(omega <= 0)
+        omega = optimalOmega(rows, cols);
+    if(n_threads <= 0)
+        n_threads = hardwareThreads();
+    n_threads = min(n_threads, rows);
+
+    //surface with a ghost border (zero flux: ghosts repeat the border pixel)
+    //weight[c] is omega at free pixels of colour c ((y + x) % 2 == c) and 0 elsewhere
+    int stride = cols + 2;
+    size_t size = (size_t)(rows + 2)*stride;
+    vector<float> u(size, 0);
+    vector<float> weight[2] = {vector<float>(size, 0), vector<float>(size, 0)};
+    double sum = 0;
+    long long n_fixed = 0;
+    for(int y = 0; y < rows; y++){
+        for(int x = 0; x < cols; x++){
+            if(points[y][x] != 0){
+                u[(size_t)(y+1)*stride + x+1] = points[y][x];
+                sum += points[y][x];
+                n_fixed++;
+            }else{
+                weight[(y + x) % 2][(size_t)(y+1)*stride + x+1] = omega;
+            }
+        }
+    }
+    if(n_fixed == 0)
+        return surface;
+
+    //free pixels start at the mean of fixed points
+    for(int y = 0; y < rows; y++){
+        for(int x = 0; x < cols; x++){
+            if(points[y][x] == 0)
+                u[(size_t)(y+1)*stride + x+1] = sum / n_fixed;
+        }
+    }
+
+    auto refreshGhosts = [&](){
+        for(int x = 1; x <= cols; x++){
+            u[x] = u[(size_t)stride + x];
+            u[(size_t)(rows+1)*stride + x] = u[(size_t)rows*stride + x];
+        }
+        for(int y = 1; y <= rows; y++){
+            u[(size_t)y*stride] = u[(size_t)y*stride + 1];
+            u[(size_t)y*stride + cols+1] = u[(size_t)y*stride + cols];
+        }
+    };
+    refreshGhosts();
+
+    //one worker per contiguous row range for the whole solve, phases separated by a barrier
+    //the first and last row of every range are copied to halo_first/halo_last after each phase (double buffered),
+    //a neighbour reads the copy of the previous phase while the owner rewrites its rows
+    int chunk = (rows + n_threads - 1) / n_threads;
+    vector<float> thread_max(n_threads, 0);
+    vector<float> halo_first[2] = {vector<float>((size_t)n_threads*cols), vector<float>((size_t)n_threads*cols)};
+    vector<float> halo_last[2] = {vector<float>((size_t)n_threads*cols), vector<float>((size_t)n_threads*cols)};
+    auto publish = [&](int t, int y_begin, int y_end, int parity){
+        if(y_begin >= y_end)
+            return;
+        const float *first = &u[(size_t)(y_begin+1)*stride + 1];
+        const float *last = &u[(size_t)y_end*stride + 1];
+        copy(first, first + cols, &halo_first[parity][(size_t)t*cols]);
+        copy(last, last + cols, &halo_last[parity][(size_t)t*cols]);
+    };
+    for(int t = 0; t < n_threads; t++){
+        publish(t, min(rows, t*chunk), min(rows, (t+1)*chunk), 0);
+    }
+    Barrier barrier(n_threads);
+
+    parallelFor(0, n_threads, [&](int t, int){
+        int y_begin = min(rows, t*chunk);
+        int y_end = min(rows, (t+1)*chunk);
+        vector<float> delta(cols);
+        vector<float> lane_max(cols, 0);
+        int phase = 0;
+        double residual = eps + 1;
+        for(int sweep = 0; sweep < max_sweeps && residual > eps; sweep++){
+            fill(lane_max.begin(), lane_max.end(), 0.0f);
+            for(int colour = 0; colour < 2; colour++, phase++){
+                //pixels of one colour only read the other colour, which no worker writes in this phase
+                //whole rows in two contiguous passes, weight[colour] is 0 at the other colour
+                for(int y = y_begin; y < y_end; y++){
+                    float *row = &u[(size_t)(y+1)*stride + 1];
+                    const float *up = (y == y_begin && y > 0) ? &halo_last[phase % 2][(size_t)(t-1)*cols] : row - stride;
+                    const float *down = (y == y_end-1 && y < rows-1) ? &halo_first[phase % 2][(size_t)(t+1)*cols] : row + stride;
+                    const float *w = &weight[colour][(size_t)(y+1)*stride + 1];
+                    float *d = delta.data();
+                    float *m = lane_max.data();
+                    for(int x = 0; x < cols; x++){
+                        d[x] = 0.25f*(up[x] + down[x] + row[x-1] + row[x+1]) - row[x];
+                    }
+                    for(int x = 0; x < cols; x++){
+                        row[x] += w[x]*d[x];
+                        float r = w[x] > 0 ? fabsf(d[x]) : 0.0f;
+                        m[x] = m[x] > r ? m[x] : r;
+                    }
+                    //ghosts of own rows (zero flux)
+                    row[-1] = row[0];
+                    row[cols] = row[cols-1];
+                }
+                if(y_begin == 0 && y_end > 0)
+                    copy(&u[(size_t)stride + 1], &u[(size_t)stride + 1 + cols], &u[1]);
+                if(y_end == rows && y_begin < y_end)
+                    copy(&u[(size_t)rows*stride + 1], &u[(size_t)rows*stride + 1 + cols], &u[(size_t)(rows+1)*stride + 1]);
+                publish(t, y_begin, y_end, (phase + 1) % 2);
+                barrier.wait();
+            }
+
+            //residual before the update, 4 * delta = sum of neighbours - n * u (gray levels), same value on every worker
+            float m = 0;
+            for(int x = 0; x < cols; x++){
+                m = m > lane_max[x] ? m : lane_max[x];
+            }
+            thread_max[t] = m;
+            barrier.wait();
+            float max_delta = 0;
+            for(int k = 0; k < n_threads; k++){
+                max_delta = max(max_delta, thread_max[k]);
+            }
+            residual = 4.0*max_delta;
+            if(t == 0 && report != nullptr){
+                report->iterations++;
+                report->residuals.push_back(residual);
+            }
+            //thread_max is written again only after the next sweep's colour barriers
+        }
+    }, n_threads);
+
+    for(int y = 0; y < rows; y++){
+        for(int x = 0; x < cols; x++){
+            surface[y][x] = (int)lround(u[(size_t)(y+1)*stride + x+1]);
+        }
+    }
+    return surface;
+}
+
+/*pool points (value != 0) into factor x factor cells with their mean value, cells without points are 0
+    c_rows and c_cols receive the coarse size
+*/
+int** poolPoints(int **points, int rows, int cols, int factor, int &c_rows, int &c_cols){
+    c_rows = (rows + factor - 1)/factor;
+    c_cols = (cols + factor - 1)/factor;
+    vector<long long> cell_sum((size_t)c_rows*c_cols, 0);
+    vector<int> cell_count((size_t)c_rows*c_cols, 0);
+    for(int y = 0; y < rows; y++){
+        for(int x = 0; x < cols; x++){
+            if(points[y][x] == 0)
+                continue;
+            size_t c = (size_t)(y/factor)*c_cols + x/factor;
+            cell_sum[c] += points[y][x];
+            cell_count[c]++;
+        }
+    }
+
+    int** coarse = createMatrix(c_rows, c_cols, 0);
+    for(int i = 0; i < c_rows; i++){
+        for(int j = 0; j < c_cols; j++){
+            size_t c = (size_t)i*c_cols + j;
+            if(cell_count[c] > 0)
+                coarse[i][j] = cell_sum[c]/cell_count[c];
+        }
+    }
+    return coarse;
+}
+
+/*Catmull-Rom weights for offset t in [0, 1) of samples -1, 0, 1, 2*/
+static void cubicWeights(double t, double w[4]){
+    w[0] = ((-t + 2)*t - 1)*t/2;
+    w[1] = ((3*t - 5)*t*t + 2)/2;
+    w[2] = ((-3*t + 4)*t + 1)*t/2;
+    w[3] = (t - 1)*t*t/2;
+}
+
+/*rows first_row .. first_row + n_rows - 1 (cols wide) of a surface upsampled from a coarse grid of factor x factor cells*/
+int** upsampleSurface(int **coarse, int c_rows, int c_cols, int factor, int first_row, int n_rows, int cols, int interpolation){
+    int** surface = createMatrix(n_rows, cols, 0);
+
+    //column cells and weights are shared by every row
+    vector<int> x0(cols);
+    vector<double> wx(cols);
+    vector<double> kx(4*cols);
+    for(int x = 0; x < cols; x++){
+        //cell centres of the coarse grid, clamped at the borders
+        double c_x = min(max((x + 0.5)/factor - 0.5, 0.0), (double)(c_cols-1));
+        x0[x] = (int)c_x;
+        wx[x] = c_x - x0[x];
+        cubicWeights(wx[x], &kx[4*x]);
+    }
+
+    for(int y = 0; y < n_rows; y++){
+        double c_y = min(max((first_row + y + 0.5)/factor - 0.5, 0.0), (double)(c_rows-1));
+        int y0 = (int)c_y;
+        double wy = c_y - y0;
+
+        if(interpolation == UPSAMPLE_BICUBIC){
+            double ky[4];
+            cubicWeights(wy, ky);
+            const int *taps[4];
+            for(int i = 0; i < 4; i++){
+                taps[i] = coarse[min(max(y0 - 1 + i, 0), c_rows-1)];
+            }
+            for(int x = 0; x < cols; x++){
+                const double *w = &kx[4*x];
+                double value = 0;
+                for(int j = 0; j < 4; j++){
+                    int xx = min(max(x0[x] - 1 + j, 0), c_cols-1);
+                    double column = ky[0]*taps[0][xx] + ky[1]*taps[1][xx] + ky[2]*taps[2][xx] + ky[3]*taps[3][xx];
+                    value += w[j]*column;
+                }
+                surface[y][x] = min(max((int)round(value), 0), 255);
+            }
+        }else{
+            const int *top_row = coarse[y0];
+            const int *bottom_row = coarse[min(y0+1, c_rows-1)];
+            for(int x = 0; x < cols; x++){
+                int x1 = min(x0[x]+1, c_cols-1);
+                double top = top_row[x0[x]]*(1-wx[x]) + top_row[x1]*wx[x];
+                double bottom = bottom_row[x0[x]]*(1-wx[x]) + bottom_row[x1]*wx[x];
+                surface[y][x] = round(top*(1-wy) + bottom*wy);
+            }
+        }
+    }
+    return surface;
+}
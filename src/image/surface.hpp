@@ -0,0 +1,58 @@
+/*Threshold surface interpolation
+    *laplace equation with fixed interpolation points (Dirichlet) and zero flux image borders
+    *float multigrid V-cycles with red-black Gauss-Seidel smoothing
+    *float red-black successive over-relaxation, in place and split across threads
+    *coarse grid mode: sample points pooled into factor x factor cells, coarse surface upsampled
+
+    Biomedical Image Processing
+    Edgar Aguilera Hernández
+    02/01/2025
+*/
+
+#ifndef SURFACE_HPP
+#define SURFACE_HPP
+
+#include <vector>
+
+using namespace std;
+
+/*threshold surface solvers*/
+const int SURFACE_SOR = 1;          //integer relaxation of Segment::interpolatePoints
+const int SURFACE_MULTIGRID = 2;    //multigridSurface
+const int SURFACE_RED_BLACK = 3;    //redBlackSORSurface
+
+/*upsampling of coarse surfaces*/
+const int UPSAMPLE_BILINEAR = 1;
+const int UPSAMPLE_BICUBIC = 2;     //Catmull-Rom, clamped to 0..255
+
+/*convergence of a surface solve*/
+struct SurfaceReport{
+    int iterations = 0;             //V-cycles or relaxation sweeps
+    vector<double> residuals;       //max |residual| over free pixels after every iteration (gray levels)
+};
+
+/*interpolate points (value != 0 is a fixed point) over a rows x cols surface with multigrid V-cycles
+    fixed points are kept at every level, stops when max |residual| <= eps or after max_cycles
+    returns the surface rounded to int (all zero without fixed points)
+*/
+int** multigridSurface(int **points, int rows, int cols, double eps, int max_cycles, SurfaceReport *report = nullptr);
+
+/*over-relaxation factor for a rows x cols laplace problem, 2 / (1 + sin(pi / max(rows, cols)))*/
+double optimalOmega(int rows, int cols);
+
+/*interpolate points (value != 0 is a fixed point) over a rows x cols surface with red-black SOR
+    every colour is updated in place, its rows split across n_threads (0: every hardware thread)
+    omega <= 0 takes optimalOmega, stops when max |residual| <= eps or after max_sweeps
+    returns the surface rounded to int (all zero without fixed points)
+*/
+int** redBlackSORSurface(int **points, int rows, int cols, double omega, double eps, int max_sweeps, SurfaceReport *report = nullptr, int n_threads = 0);
+
+/*pool points (value != 0) into factor x factor cells with their mean value, cells without points are 0
+    c_rows and c_cols receive the coarse size
+*/
+int** poolPoints(int **points, int rows, int cols, int factor, int &c_rows, int &c_cols);
+
+/*rows first_row .. first_row + n_rows - 1 (cols wide) of a surface upsampled from a coarse grid of factor x factor cells*/
+int** upsampleSurface(int **coarse, int c_rows, int c_cols, int factor, int first_row, int n_rows, int cols, int interpolation = UPSAMPLE_BILINEAR);
+
+#endif
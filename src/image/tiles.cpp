@@ -0,0 +1,359 @@
+/*Tiled out-of-core processing
+    *row streaming PGM reader and writer (P2/P5 in, P5 out)
+    *band (tile) execution with halos, bands processed in parallel and stitched in order
+    *streaming connected components with union-find merged across rows
+
+    Biomedical Image Processing
+    Edgar Aguilera Hernández
+    02/01/2025
+*/
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <memory>
+#include <fstream>
+#include <iostream>
+#include <cstdio>
+#include "tiles.hpp"
+#include "parallel.hpp"
+#include "morph_op.hpp"
+
+using namespace std;
+
+//------------------------------------------PGMRowReader
+PGMRowReader::PGMRowReader(){
+    binary = false;
+    rows = 0;
+    cols = 0;
+    next_row = 0;
+}
+
+PGMRowReader::~PGMRowReader(){
+    close();
+}
+
+/*open file and read header, returns 0 on error*/
+int PGMRowReader::open(string fileName){
+    string line;
+    int maximumValue = 0;
+
+    file.open(fileName, ios_base::binary);
+    if (!(file.is_open())) {
+        printf ("ERROR: cannot open file to read\n\n");
+        return (0);
+    }
+
+    /* Check the file signature ("Magic Numbers" P2 and P5); skip comments */
+    getline(file,line);
+    while (line[0]=='#' || line[0]=='\n')
+        getline(file,line);
+
+    if (line[0]=='P' && line[1]=='2')
+        binary = false;
+    else if (line[0]=='P' && line[1]=='5')
+        binary = true;
+    else {
+        printf ("ERROR: incorrect file format\n\n");
+        file.close();
+        return (0);
+    }
+
+    /* Input the width, height and maximum value, skip comments */
+    getline(file,line);
+    while (line[0]=='#' || line[0]=='\n')
+        getline(file,line);
+    sscanf (line.c_str(),"%d %d",&cols,&rows);
+
+    getline(file,line);
+    while (line[0]=='#' || line[0]=='\n')
+        getline(file,line);
+    sscanf (line.c_str(),"%d",&maximumValue);
+
+    if (cols<1 || rows<1 || maximumValue<0 || maximumValue>255){
+        printf ("ERROR: invalid file specifications (cols/rows/max value)\n\n");
+        file.close();
+        return (0);
+    }
+
+    next_row = 0;
+    return (1);
+}
+
+/*read next row into row (cols values), returns 0 when no rows are left*/
+int PGMRowReader::readRow(int *row){
+    if(next_row >= rows)
+        return 0;
+
+    if(binary){
+        vector<unsigned char> bytes(cols, 0);
+        file.read((char*)bytes.data(), cols);
+        for(int j = 0; j < cols; j++){
+            row[j] = bytes[j];
+        }
+    }else{
+        for(int j = 0; j < cols; j++){
+            row[j] = 0;
+            file >> row[j];
+        }
+    }
+
+    next_row++;
+    return 1;
+}
+
+void PGMRowReader::close(){
+    if(file.is_open())
+        file.close();
+}
+
+//------------------------------------------PGMRowWriter
+/*open file and write header, returns 0 on error*/
+int PGMRowWriter::open(string fileName, int rows, int n_cols, string comment_string){
+    cols = n_cols;
+    buffer.assign(cols, 0);
+
+    file.open(fileName, ios_base::binary);
+    if (!(file.is_open())) {
+        printf ("ERROR: cannot open file to write\n\n");
+        return (0);
+    }
+
+    //file headers
+    file << "P5\n";
+    if (comment_string.size() != 0)
+        file << "#" << comment_string << "\n";
+    file << cols << " " << rows << "\n";
+    file << "255\n";
+    return (1);
+}
+
+void PGMRowWriter::writeRow(const int *row){
+    for(int j = 0; j < cols; j++){
+        int v = row[j];
+        buffer[j] = (unsigned char)(v < 0 ? 0 : (v > 255 ? 255 : v));
+    }
+    file.write((const char*)buffer.data(), cols);
+}
+
+void PGMRowWriter::close(){
+    if(file.is_open())
+        file.close();
+}
+
+//------------------------------------------band execution
+/*run op over bands of band_rows rows with halo rows above and below, reading every input file once
+    groups of n_threads bands are kept in memory and processed in parallel, output rows are written in order
+    output_file = "" discards the results (statistics passes); returns 0 on error
+*/
+int processBands(const vector<string> &input_files, string output_file, int band_rows, int halo, const BandOperation &op, int n_threads, string comment_string){
+    int n_inputs = input_files.size();
+    if(n_inputs == 0 || band_rows < 1)
+        return 0;
+
+    //every input streamed in lockstep
+    vector<unique_ptr<PGMRowReader>> readers;
+    for(int k = 0; k < n_inputs; k++){
+        readers.push_back(unique_ptr<PGMRowReader>(new PGMRowReader()));
+        if(!readers[k]->open(input_files[k]))
+            return 0;
+        if(readers[k]->getRows() != readers[0]->getRows() || readers[k]->getCols() != readers[0]->getCols()){
+            cout<<"ERROR: band inputs with different size: "<<input_files[k]<<endl;
+            return 0;
+        }
+    }
+    int rows = readers[0]->getRows();
+    int cols = readers[0]->getCols();
+
+    PGMRowWriter writer;
+    bool write_output = output_file.size() != 0;
+    if(write_output && !writer.open(output_file, rows, cols, comment_string))
+        return 0;
+
+    if(n_threads <= 0)
+        n_threads = hardwareThreads();
+
+    //rows currently held in memory: [buf_first, buf_end)
+    vector<deque<vector<int>>> buffer(n_inputs);
+    int buf_first = 0;
+    int buf_end = 0;
+
+    for(int g = 0; g < rows; g += band_rows*n_threads){
+        int g_end = min(rows, g + band_rows*n_threads);
+        int need_first = max(0, g - halo);
+        int need_end = min(rows, g_end + halo);
+
+        //release rows no longer covered by any halo
+        while(buf_first < need_first){
+            for(int k = 0; k < n_inputs; k++){
+                buffer[k].pop_front();
+            }
+            buf_first++;
+        }
+        //read rows for this group of bands
+        while(buf_end < need_end){
+            for(int k = 0; k < n_inputs; k++){
+                buffer[k].push_back(vector<int>(cols, 0));
+                readers[k]->readRow(buffer[k].back().data());
+            }
+            buf_end++;
+        }
+
+        int n_bands = (g_end - g + band_rows - 1) / band_rows;
+        vector<int**> results(n_bands, nullptr);
+        vector<int> first_rows(n_bands);
+
+        //bands share halo rows, so inputs are read only
+        parallelFor(0, n_bands, [&](int b_begin, int b_end){
+            for(int b = b_begin; b < b_end; b++){
+                int start = g + b*band_rows;
+                int end = min(start + band_rows, g_end);
+                int first = max(0, start - halo);
+                int last = min(rows, end + halo);
+                int n_rows = last - first;
+                first_rows[b] = first;
+
+                vector<int**> inputs(n_inputs);
+                for(int k = 0; k < n_inputs; k++){
+                    inputs[k] = new int*[n_rows];
+                    for(int r = 0; r < n_rows; r++){
+                        inputs[k][r] = buffer[k][first - buf_first + r].data();
+                    }
+                }
+
+                results[b] = op(inputs, n_rows, cols, first, start - first, end - first);
+
+                for(int k = 0; k < n_inputs; k++){
+                    delete[] inputs[k];
+                }
+            }
+        }, n_threads);
+
+        //stitch band interiors in order
+        for(int b = 0; b < n_bands; b++){
+            int start = g + b*band_rows;
+            int end = min(start + band_rows, g_end);
+            int first = first_rows[b];
+            int last = min(rows, end + halo);
+            if(write_output && results[b] != nullptr){
+                for(int r = start; r < end; r++){
+                    writer.writeRow(results[b][r - first]);
+                }
+            }
+            freeMatrix(results[b], last - first);
+        }
+    }
+
+    writer.close();
+    return 1;
+}
+
+//------------------------------------------streaming connected components
+/*root of label with path halving*/
+static int findLabel(vector<int> &parent, int label){
+    while(parent[label] != label){
+        parent[label] = parent[parent[label]];
+        label = parent[label];
+    }
+    return label;
+}
+
+/*merge two label sets keeping the smallest root*/
+static void unionLabels(vector<int> &parent, int a, int b){
+    a = findLabel(parent, a);
+    b = findLabel(parent, b);
+    if(a < b)
+        parent[b] = a;
+    else if(b < a)
+        parent[a] = b;
+}
+
+/*label one row from previous row labels; new labels are created in the same order on every pass
+    merge = true records equivalences, otherwise labels are resolved to their final root
+*/
+static void labelRow(const int *row, const vector<int> &prev, vector<int> &cur, int cols, vector<int> &parent, int &next_label, bool merge){
+    for(int x = 0; x < cols; x++){
+        cur[x] = 0;
+        if(row[x] == 0)
+            continue;
+
+        //already labelled neighbours: left, upper left, upper, upper right
+        int neighbours[4] = {x > 0 ? cur[x-1] : 0, x > 0 ? prev[x-1] : 0, prev[x], x+1 < cols ? prev[x+1] : 0};
+        int label = 0;
+        for(int k = 0; k < 4; k++){
+            if(neighbours[k] == 0)
+                continue;
+            if(label == 0)
+                label = neighbours[k];
+            else if(merge)
+                unionLabels(parent, label, neighbours[k]);
+        }
+
+        if(label == 0){
+            label = next_label++;
+            if(merge)
+                parent.push_back(label);
+        }
+        cur[x] = merge ? label : findLabel(parent, label);
+    }
+}
+
+/*keep 8-connected components (value != 0) with at least size_threshold pixels, streaming rows twice
+    provisional labels of consecutive rows are merged with union-find, memory is two rows plus the label table
+*/
+int connectedComponentsStream(string input_file, string output_file, int size_threshold){
+    PGMRowReader reader;
+    if(!reader.open(input_file))
+        return 0;
+    int rows = reader.getRows();
+    int cols = reader.getCols();
+
+    vector<int> row(cols), prev(cols, 0), cur(cols, 0);
+    //label 0 is background
+    vector<int> parent(1, 0);
+    vector<long long> area(1, 0);
+    int next_label = 1;
+
+    //1. provisional labels, equivalences and area per provisional label
+    for(int y = 0; y < rows; y++){
+        reader.readRow(row.data());
+        labelRow(row.data(), prev, cur, cols, parent, next_label, true);
+        area.resize(parent.size(), 0);
+        for(int x = 0; x < cols; x++){
+            if(cur[x] != 0)
+                area[cur[x]]++;
+        }
+        swap(prev, cur);
+    }
+    reader.close();
+
+    //component size at every root
+    vector<long long> total(parent.size(), 0);
+    for(int l = 1; l < (int)parent.size(); l++){
+        total[findLabel(parent, l)] += area[l];
+    }
+
+    //2. same labelling again, resolving roots and filtering by size
+    if(!reader.open(input_file))
+        return 0;
+    PGMRowWriter writer;
+    if(!writer.open(output_file, rows, cols, "connected components >= " + to_string(size_threshold)))
+        return 0;
+
+    fill(prev.begin(), prev.end(), 0);
+    next_label = 1;
+    vector<int> out(cols);
+    for(int y = 0; y < rows; y++){
+        reader.readRow(row.data());
+        labelRow(row.data(), prev, cur, cols, parent, next_label, false);
+        for(int x = 0; x < cols; x++){
+            out[x] = (cur[x] != 0 && total[cur[x]] >= size_threshold) ? 255 : 0;
+        }
+        writer.writeRow(out.data());
+        swap(prev, cur);
+    }
+
+    reader.close();
+    writer.close();
+    return 1;
+}
@@ -0,0 +1,84 @@
+/*Tiled out-of-core processing
+    *row streaming PGM reader and writer (P2/P5 in, P5 out)
+    *band (tile) execution with halos, bands processed in parallel and stitched in order
+    *streaming connected components with union-find merged across rows
+
+    Biomedical Image Processing
+    Edgar Aguilera Hernández
+    02/01/2025
+*/
+
+#ifndef TILES_HPP
+#define TILES_HPP
+
+#include <string>
+#include <vector>
+#include <fstream>
+#include <functional>
+
+using namespace std;
+
+/*sequential row reader for P2 (ASCII) and P5 (binary) pgm files*/
+class PGMRowReader{
+    private:
+        ifstream file;
+        bool binary;
+        int rows;
+        int cols;
+        int next_row;
+
+    public:
+        PGMRowReader();
+        ~PGMRowReader();
+
+        /*open file and read header, returns 0 on error*/
+        int open(string fileName);
+
+        /*read next row into row (cols values), returns 0 when no rows are left*/
+        int readRow(int *row);
+
+        void close();
+
+        int getRows(){
+            return rows;
+        }
+
+        int getCols(){
+            return cols;
+        }
+};
+
+/*sequential row writer producing binary (P5) pgm files, values are clamped to 0-255*/
+class PGMRowWriter{
+    private:
+        ofstream file;
+        int cols;
+        vector<unsigned char> buffer;
+
+    public:
+        /*open file and write header, returns 0 on error*/
+        int open(string fileName, int rows, int cols, string comment_string = "");
+
+        void writeRow(const int *row);
+
+        void close();
+};
+
+/*operation over a band: inputs[k] holds n_rows rows (band plus halos) of input file k, first_row is the image row of inputs[k][0]
+    rows [band_begin, band_end) of inputs are the band itself (the ones written to output)
+    returns a new n_rows x cols matrix (or nullptr when there is no output file)
+*/
+typedef function<int**(const vector<int**> &inputs, int n_rows, int cols, int first_row, int band_begin, int band_end)> BandOperation;
+
+/*run op over bands of band_rows rows with halo rows above and below, reading every input file once
+    groups of n_threads bands are kept in memory and processed in parallel, output rows are written in order
+    output_file = "" discards the results (statistics passes); returns 0 on error
+*/
+int processBands(const vector<string> &input_files, string output_file, int band_rows, int halo, const BandOperation &op, int n_threads = 0, string comment_string = "");
+
+/*keep 8-connected components (value != 0) with at least size_threshold pixels, streaming rows twice
+    provisional labels of consecutive rows are merged with union-find, memory is two rows plus the label table
+*/
+int connectedComponentsStream(string input_file, string output_file, int size_threshold);
+
+#endif
@@ -11,6 +11,16 @@
 #include <sstream>
 #include <bits/stdc++.h>
 #include "image/morph_op.hpp"
+#include "image/fft.hpp"
+#include "image/filter_bank.hpp"
+#include "image/distance.hpp"
+#include "image/stats.hpp"
+#include "image/pipeline.hpp"
+#include "image/tiles.hpp"
+#include "image/parallel.hpp"
+#include "image/morph_delta.hpp"
+#include "image/surface.hpp"
+#include "image/components.hpp"
 
 //number of elements in dataset
 int db_size;
@@ -26,6 +36,10 @@ string save_path_segment;
 string mask_path;
 //path for groundtruth
 string gt_path;
+//write intermediate debug images (rotated GMF kernels)
+bool debug_dump = false;
+//directory of on-disk GMF kernel banks ("": kernel banks are only cached in memory)
+string gmf_bank_dir = "";
 
 using namespace std;
 class Image{
@@ -259,19 +273,10 @@ class Image{
             return temp;
         }
 
-        /*apply convolution operation with a given kernel*/
-        int** convolution(int** kernel,int k_rows, int k_cols, int inplace = true){
-            int **img_write;
-            if(inplace){
-                img_write = img;
-            }else{
-                img_write = createMatrix(rows,cols,0);
-            }
-            
-            //filter matrix center
-            int center_i = k_rows/2;
-            int center_j = k_cols/2;
-
+        /*apply convolution operation with a given kernel
+            kernels with at least fft_taps taps are computed in frequency domain (fft_taps <= 0 forces direct path)
+        */
+        int** convolution(int** kernel,int k_rows, int k_cols, int inplace = true, int fft_taps = FFT_TAPS_THRESHOLD){
             //window mutiply accumulator and division coefficient
             int aux;
             int div_c = 0;
@@ -284,6 +289,28 @@ class Image{
             }
             if(div_c == 0)
                 div_c = 1;
+
+            //large kernels: O(N log N) frequency domain path
+            if(fftConvolutionPreferred(k_rows, k_cols, fft_taps)){
+                int **img_fft = fftConvolution(img, rows, cols, kernel, k_rows, k_cols, div_c);
+                if(!inplace)
+                    return img_fft;
+
+                freeMatrix(img,rows);
+                img = img_fft;
+                return img;
+            }
+
+            int **img_write;
+            if(inplace){
+                img_write = img;
+            }else{
+                img_write = createMatrix(rows,cols,0);
+            }
+            
+            //filter matrix center
+            int center_i = k_rows/2;
+            int center_j = k_cols/2;
             
             //iterator over patches pixels
             for ( int y = 0; y < rows; y++ ){
@@ -444,26 +471,13 @@ class Image{
 
             int** img_write = createMatrix(rows,cols,0);
 
-            int max = 0;
-            int min = 100000;
-
-            //get max value
-            for(int i = 0; i< rows; i++){
-                for(int j = 0; j< cols; j++){
-                    if(mask != nullptr){
-                        if(mask[i][j] == 0)
-                            continue;
-                    }
-                    if(max < img_input[i][j])
-                        max = img_input[i][j];
-                    if(min > img_input[i][j])
-                        min = img_input[i][j];
-
-                }
-            }
+            //get max and min value
+            ImageStats stats = imageStatistics(img_input,rows,cols,mask);
+            int max = stats.max;
+            int min = stats.min;
 
-            //apply normalization
-            for(int i = 0; i< rows; i++){
+            //apply normalization (flat images are left at 0)
+            for(int i = 0; i< rows && max > min; i++){
                 for(int j = 0; j< cols; j++){
                     if(mask != nullptr){
                         if(mask[i][j] == 0)
@@ -521,50 +535,24 @@ class Image{
             }else{
                 img_input = image;
             }
-            
-            //pixel accumulator
-            int aux = 0;
-            int n_pixels = 0;
 
-            //iterator over patches pixels
-            for ( int y = 0; y < rows; y++ ){
-                for ( int x = 0; x < cols; x++ ){
-                    if(mask != nullptr){
-                        if(mask[y][x] != 0){
-                            n_pixels++;
-                            aux += img_input[y][x];
-                        }
-                            
-                    }else{
-                        n_pixels++;
-                        aux += img_input[y][x];
-                    }
-                        
-                    
-                }
-            }
+            return imageStatistics(img_input,rows,cols,mask).mean();
+        }
 
-            return round(aux / n_pixels);
+        /*Compute min, max, arg-max, sum, sum of squares, count and histogram in one pass*/
+        ImageStats statistics(int** mask = nullptr){
+            return imageStatistics(img,rows,cols,mask);
         }
 
         /*find max value coordinates */
         void maxCoordinates(int yx_center[]){
-            int max = 0;
-
-            //iterator over image
-            for ( int i = 0; i < rows; i++ ){
-                for ( int j = 0; j < cols; j++ ){
+            ImageStats stats = imageStatistics(img,rows,cols);
 
-                    if(img[i][j] > max){
-                        max = img[i][j];
-                        yx_center[0] = i;
-                        yx_center[1] = j;
-                    }
-                        
-                    
-                }
+            //only positive maxima are reported
+            if(stats.max > 0){
+                yx_center[0] = stats.argmax_y;
+                yx_center[1] = stats.argmax_x;
             }
-
         }
 
         /*Compute mean from a 5x5 window*/
@@ -737,136 +725,184 @@ class Image{
             return img_write;
         }
 
-        /*compute edge using Canny algorithm*/
-        void cannyEdge(){
-
-            //1. smooth image
-            gauss_filter(true);
-
-            //2. compute gradient magnitude and direction matrix
-            int** grad_angle = createMatrix(rows,cols,0);
-            scharr_gradient(true,grad_angle);  
-            
-            //3. Non-maximum supression
-            for(int i = 1; i< rows-1; i++){
-                for(int j = 1; j< cols-1; j++){
-                    //check for direction of gradient
-                    if(abs(grad_angle[i][j]) >= 68){
-                        if(img[i][j] < img[i-1][j] || img[i][j] < img[i+1][j])
-                            img[i][j] = 0;
-
-                    }else if(grad_angle[i][j] < 68 && grad_angle[i][j] >= 22){
-                        if(img[i][j] < img[i-1][j+1] || img[i][j] < img[i+1][j-1])
-                            img[i][j] = 0;
-
-                    }else if(abs(grad_angle[i][j]) < 22){
-                        if(img[i][j] < img[i][j+1] || img[i][j] < img[i][j-1])
-                            img[i][j] = 0;
-
-                    }else if(grad_angle[i][j] <= -22 && grad_angle[i][j] > -68){
-                        if(img[i][j] < img[i-1][j-1] || img[i][j] < img[i+1][j+1] )
-                            img[i][j] = 0;
+        /*compute edge using Canny algorithm, streaming rows through ring buffers
+            gradient >= max_t: strong edge, gradient >= min_t: weak edge kept if connected to a strong one
+            result is a binary edge map (255 edge, 0 background)
+        */
+        void cannyEdge(int max_t = 2000, int min_t = 1900){
+
+            //Gauss kernel window
+            int gauss[5][5] = {{1,4,7,4,1},
+                               {4,16,26,16,4},
+                               {7,26,41,26,7},
+                               {4,16,26,16,4},
+                               {1,4,7,4,1}};
+            int div_c = 273;
+
+            //ring buffers: 3 smoothed rows, 3 gradient magnitude and direction rows
+            vector<int> smooth_ring(3*cols, 0);
+            vector<int> mag_ring(3*cols, 0);
+            vector<unsigned char> dir_ring(3*cols, 0);
+
+            //edge map: 0 none, 1 weak, 255 strong
+            int** edges = createMatrix(rows,cols,0);
+            vector<int> strong_stack;
+            vector<int> weak_list;
+
+            //smoothed row r is produced at step r, gradient row r-1 and suppressed row r-2 follow behind
+            for(int r = 0; r < rows + 2; r++){
+
+                //1. smooth row r
+                if(r < rows){
+                    int* smooth_row = &smooth_ring[(r % 3)*cols];
+                    for(int x = 0; x < cols; x++){
+                        int aux = 0;
+                        for(int i = r-2; i <= r+2; i++){
+                            if(i < 0 || i >= rows)
+                                continue;
+                            for(int j = x-2; j <= x+2; j++){
+                                if(j < 0 || j >= cols)
+                                    continue;
+                                aux += img[i][j] * gauss[i-r+2][j-x+2];
+                            }
+                        }
+                        smooth_row[x] = aux / div_c;
                     }
-                    
-                    
                 }
-            }
-            
-            //set gradient into 0 - 255 level
-            //normalize();
-
-            //4. Double thrheshold filtering
-            int max_t = 2000;
-            int min_t = 1900;
 
-            //weak pixel matrix
-            int** weak_edges = copyImage(img,rows,cols);
+                //2. Scharr gradient magnitude and quantized direction of row g
+                int g = r - 1;
+                if(g >= 0 && g < rows){
+                    int* top = (g > 0) ? &smooth_ring[((g-1) % 3)*cols] : nullptr;
+                    int* mid = &smooth_ring[(g % 3)*cols];
+                    int* bottom = (g+1 < rows) ? &smooth_ring[((g+1) % 3)*cols] : nullptr;
+                    int* mag_row = &mag_ring[(g % 3)*cols];
+                    unsigned char* dir_row = &dir_ring[(g % 3)*cols];
+
+                    for(int x = 0; x < cols; x++){
+                        int xl = x-1, xr = x+1;
+                        //out of image pixels count as zero
+                        int tl = (top && xl >= 0) ? top[xl] : 0;
+                        int tc = top ? top[x] : 0;
+                        int tr = (top && xr < cols) ? top[xr] : 0;
+                        int ml = (xl >= 0) ? mid[xl] : 0;
+                        int mr = (xr < cols) ? mid[xr] : 0;
+                        int bl = (bottom && xl >= 0) ? bottom[xl] : 0;
+                        int bc = bottom ? bottom[x] : 0;
+                        int br = (bottom && xr < cols) ? bottom[xr] : 0;
+
+                        //image coordinates: x to the right, y downwards
+                        int dx = 3*(tr - tl) + 10*(mr - ml) + 3*(br - bl);
+                        int dy = 3*(bl - tl) + 10*(bc - tc) + 3*(br - tr);
+                        mag_row[x] = (int)sqrt(dx*dx + dy*dy);
+
+                        //0: horizontal, 1: vertical, 2: diagonal down-right, 3: diagonal up-right (tan(22.5) ~ 0.414)
+                        long ax = abs(dx), ay = abs(dy);
+                        if(ay*1000 <= ax*414)
+                            dir_row[x] = 0;
+                        else if(ax*1000 <= ay*414)
+                            dir_row[x] = 1;
+                        else if((dx > 0) == (dy > 0))
+                            dir_row[x] = 2;
+                        else
+                            dir_row[x] = 3;
+                    }
+                }
 
-            for(int i = 1; i< rows-1; i++){
-                for(int j = 1; j< cols-1; j++){
-                    //strong gradient
-                    if(img[i][j] >= max_t){
-                        weak_edges[i][j] = 0;
+                //3. Non-maximum supression and double threshold of row n (image border is discarded)
+                int n = r - 2;
+                if(n >= 1 && n < rows-1){
+                    int* m_top = &mag_ring[((n-1) % 3)*cols];
+                    int* m_mid = &mag_ring[(n % 3)*cols];
+                    int* m_bottom = &mag_ring[((n+1) % 3)*cols];
+                    unsigned char* dir_row = &dir_ring[(n % 3)*cols];
+
+                    for(int x = 1; x < cols-1; x++){
+                        int mag = m_mid[x];
+                        if(mag < min_t)
+                            continue;
 
-                    }else if(img[i][j] >= min_t){
-                        img[i][j] = 0; //weak gradient
+                        int n1, n2;
+                        if(dir_row[x] == 0){
+                            n1 = m_mid[x-1];
+                            n2 = m_mid[x+1];
+                        }else if(dir_row[x] == 1){
+                            n1 = m_top[x];
+                            n2 = m_bottom[x];
+                        }else if(dir_row[x] == 2){
+                            n1 = m_top[x-1];
+                            n2 = m_bottom[x+1];
+                        }else{
+                            n1 = m_top[x+1];
+                            n2 = m_bottom[x-1];
+                        }
+                        if(mag < n1 || mag < n2)
+                            continue;
 
-                    } else if(img[i][j] < min_t){
-                        img[i][j] = 0;       //supressing gradients
-                        weak_edges[i][j] = 0;
-                    }   
+                        if(mag >= max_t){
+                            edges[n][x] = 255;
+                            strong_stack.push_back(n*cols + x);
+                        }else{
+                            edges[n][x] = 1;
+                            weak_list.push_back(n*cols + x);
+                        }
+                    }
                 }
             }
 
-            //5. Evaluate strong, weak pixels by hysteresis
-            for(int i = 1; i< rows-1; i++){
-                for(int j = 1; j< cols-1; j++){
-                    //check for weak gradient
-                    if(weak_edges[i][j] == 0)
-                        continue;
+            //4. hysteresis: grow strong edges through connected weak pixels
+            while(!strong_stack.empty()){
+                int p = strong_stack.back();
+                strong_stack.pop_back();
+                int y = p / cols;
+                int x = p % cols;
 
-                    //window around weak pixel
-                    for(int k = i - 1; k <= i+1; k++){
-                        for(int l = j - 1; l <= j+1; l++){                         
-                            if(img[k][l] != 0){
-                                img[i][j] = weak_edges[i][j];
-                                break;
-                            }   
+                for(int k = y-1; k <= y+1; k++){
+                    for(int l = x-1; l <= x+1; l++){
+                        if(k < 0 || l < 0 || k >= rows || l >= cols)
+                            continue;
+                        if(edges[k][l] == 1){
+                            edges[k][l] = 255;
+                            strong_stack.push_back(k*cols + l);
                         }
                     }
-
                 }
             }
-            
-            
-            delete grad_angle[0];
-            delete grad_angle;
-            delete weak_edges[0];
-            delete weak_edges;
-            
-        }
 
-        /*Measure distance from a skeletonized image to the edge of its structure in a given image_matrix*/
-        int** radialEdgeSearch(int** edge_image, int** mask, int radial_t, int scale = 1){
+            //weak pixels never reached are discarded
+            for(int k = 0; k < (int)weak_list.size(); k++){
+                int y = weak_list[k] / cols;
+                int x = weak_list[k] % cols;
+                if(edges[y][x] == 1)
+                    edges[y][x] = 0;
+            }
+
+            freeMatrix(img,rows);
+            img = edges;
+        }
 
-            int radius;
-            int** radii_matrix = createMatrix(rows,cols,0);
+        /*Measure euclidean distance from a skeletonized image to the edge of its structure in a given edge image
+            skeleton pixels lying on an edge measure half a pixel, pixels farther than radial_t (or outside mask) measure 0
+        */
+        double** edgeDistance(int** edge_image, int** mask, double radial_t){
+            double** radii_matrix = createDoubleMatrix(rows,cols,0);
+            //distance to closest edge computed once for the whole image
+            double** edge_dist = euclideanDistanceTransform(edge_image,rows,cols);
 
             for(int i = 0; i < rows; i++){
                 for(int j = 0; j < cols; j++){
-                    if(mask == 0 || img[i][j] == 0)
+                    if((mask != nullptr && mask[i][j] == 0) || img[i][j] == 0)
                         continue;
 
-                    radius = 1;
-                    while(radius <= radial_t ){
-
-                        //window around central skeleton
-                        for(int k = i - radius; k <= i+radius; k++){
-                            for(int l = j - radius; l <= j+radius; l++){  
-                                //exclude non fitting or pixel width found
-                                if((k<0) || (l<0) || (k >= rows) || (l >= cols) || (radii_matrix[i][j] != 0))
-                                    continue;
-                                
-                                if((k == i && l == j) && edge_image[k][l] > 0)
-                                    radii_matrix[i][j] = -5;  //decimal part representation
-                                else if(edge_image[k][l] > 0)
-                                    radii_matrix[i][j] = radius*scale;
-                                
-                            }
-                        }
-
-                        //edge reached
-                        if(radii_matrix[i][j] != 0)
-                            break;
-
-                        radius++;
-                    }
-
+                    if(edge_dist[i][j] == 0)
+                        radii_matrix[i][j] = 0.5;
+                    else if(edge_dist[i][j] <= radial_t)
+                        radii_matrix[i][j] = edge_dist[i][j];
                 }
             }
 
+            freeMatrix(edge_dist,rows);
             return radii_matrix;
-
         }
 
         /*get original image values that result from applying a threshold; foreground = true (if threshold < img), foreground = false (if threshold > img)*/
@@ -904,6 +940,23 @@ class Image{
         }
 };
 
+/*vessel / non vessel histograms of pixels inside mask, values < 0 are below every threshold and values > 255 above every one*/
+struct ClassHistogram{
+    long long vessel[256] = {0};
+    long long background[256] = {0};
+    long long vessel_total = 0;
+    long long background_total = 0;
+
+    void add(const ClassHistogram &other){
+        for(int i = 0; i < 256; i++){
+            vessel[i] += other.vessel[i];
+            background[i] += other.background[i];
+        }
+        vessel_total += other.vessel_total;
+        background_total += other.background_total;
+    }
+};
+
 class ROC{
     private:
         vector<Image*> elements;
@@ -915,12 +968,18 @@ class ROC{
         double confusion[4][256];   //TP, TN, FP, FN x 255 tresholds
         double sens[256];
         double spec[256];
+        double precision[256];      //per threshold (not sorted)
+        double recall[256];
+        double f1[256];
+
+        //streamed per class histograms inside mask
+        ClassHistogram counts;
     
     public:
         ROC(){
             strel = "none";
             area = 0;
-
+            resetCounts();
         }
 
         ROC(string struct_element,int newstrel_param[]){
@@ -938,6 +997,7 @@ class ROC{
                 confusion[2][i] = 0;
                 confusion[3][i] = 0;
             }
+            resetCounts();
         }
 
         ~ROC(){
@@ -999,6 +1059,24 @@ class ROC{
 
         }
 
+        /*copy masks and groundtruth already in memory (downsampled datasets) instead of reading them*/
+        void setReferenceImages(const vector<Image*> &new_mask, const vector<Image*> &new_gt){
+            if((int)mask.size() > 0 || (int)groundtruth.size() > 0)
+                return;
+
+            Image *ptr;
+            for(int i = 0; i < (int)new_mask.size(); i++){
+                ptr = new Image();
+                ptr->setImage(new_mask[i]->getImage(),new_mask[i]->getRows(),new_mask[i]->getCols(),false,true);
+                mask.push_back(ptr);
+            }
+            for(int i = 0; i < (int)new_gt.size(); i++){
+                ptr = new Image();
+                ptr->setImage(new_gt[i]->getImage(),new_gt[i]->getRows(),new_gt[i]->getCols(),false,true);
+                groundtruth.push_back(ptr);
+            }
+        }
+
         /*read images from dataset into an array*/
         void buildImageArray(string dataset_path, int n_images, int init_ref, string new_strel = "test"){
             //update datset strel
@@ -1024,7 +1102,7 @@ class ROC{
             elements.push_back(newImage);
         }
 
-        /*reset enhanced image array*/
+        /*reset enhanced image array and accumulated counts*/
         void clearEnhanceArray(){
             if((int)elements.size() > 0 ){
                 for(int i= 0; i<(int)elements.size(); i++){
@@ -1032,56 +1110,83 @@ class ROC{
                 }
                 elements.clear();
             }
+            resetCounts();
         }
 
-        /*calculate confusion matrix*/
-        void calculateConfusionMatrix(bool available_mask = false){
-            int **image;
-            int **gt;
-            int **mk;
+        /*reset accumulated histograms*/
+        void resetCounts(){
+            counts = ClassHistogram();
+        }
 
-            for(int i = 0; i < 256; i++){
-                confusion[0][i] = 0;
-                confusion[1][i] = 0;
-                confusion[2][i] = 0;
-                confusion[3][i] = 0;
-            }
+        /*histograms of an enhanced image using groundtruth and mask at index (masks and groundtruth must be loaded)*/
+        ClassHistogram imageHistogram(int** image, int rows, int cols, int index, bool available_mask = true){
+            ClassHistogram hist;
+            int **gt = groundtruth[index]->getImage();
+            int **mk = available_mask ? mask[index]->getImage() : nullptr;
 
-            //evalute per pixel (m x n x i_images)
-            for(int i = 0; i < (int)elements.size(); i++){
-                image = elements[i]->getImage();
-                gt = groundtruth[i]->getImage();
-                if(available_mask)
-                    mk = mask[i]->getImage();  
-
-                //apply calculation per threshold
-                //***using inverted image as we need vessels appear brighter
-                for(int j = 0; j< 256; j++){
-
-                    for(int m = 0; m < elements[i]->getRows(); m++){
-                        for(int n = 0; n < elements[i]->getCols(); n++){
-                            if(!available_mask || mk[m][n] != 0){
-                                //TP
-                                if(image[m][n] >= j && gt[m][n] != 0){
-                                    confusion[0][j] += 1; 
-                                }
-                                //TN
-                                if(image[m][n] < j && gt[m][n] == 0){
-                                    confusion[1][j] += 1; 
-                                }
-                                //FP
-                                if(image[m][n] >= j && gt[m][n] == 0){
-                                    confusion[2][j] += 1; 
-                                }
-                                //FN
-                                if(image[m][n] < j && gt[m][n] != 0){
-                                    confusion[3][j] += 1; 
-                                }
-                            }
-                        }
+            for(int m = 0; m < rows; m++){
+                for(int n = 0; n < cols; n++){
+                    if(available_mask && mk[m][n] == 0)
+                        continue;
+
+                    int value = image[m][n];
+                    if(gt[m][n] != 0){
+                        hist.vessel_total++;
+                        if(value >= 0)
+                            hist.vessel[value > 255 ? 255 : value]++;
+                    }else{
+                        hist.background_total++;
+                        if(value >= 0)
+                            hist.background[value > 255 ? 255 : value]++;
                     }
                 }
-                
+            }
+            return hist;
+        }
+
+        /*add histograms to accumulated counts*/
+        void addCounts(const ClassHistogram &hist){
+            counts.add(hist);
+        }
+
+        /*fold an enhanced image into vessel / non vessel histograms using groundtruth and mask at index
+            the image is not retained, so it can be freed right after (masks and groundtruth must be loaded)
+        */
+        void accumulateImage(int** image, int rows, int cols, int index, bool available_mask = true){
+            addCounts(imageHistogram(image,rows,cols,index,available_mask));
+        }
+
+        /*calculate confusion matrix for every threshold from vessel / non vessel histograms
+            TP(t) = vessel pixels >= t, FP(t) = non vessel pixels >= t (suffix sums), FN and TN are the complements
+            images stored in the array are folded first, otherwise the streamed counts are used
+        */
+        void calculateConfusionMatrix(bool available_mask = false){
+            if((int)elements.size() > 0){
+                resetCounts();
+                for(int i = 0; i < (int)elements.size(); i++){
+                    accumulateImage(elements[i]->getImage(),elements[i]->getRows(),elements[i]->getCols(),i,available_mask);
+                }
+            }
+
+            //counts per threshold
+            //***using inverted image as we need vessels appear brighter
+            long long vessel_above = 0;
+            long long background_above = 0;
+            for(int j = 255; j >= 0; j--){
+                vessel_above += counts.vessel[j];
+                background_above += counts.background[j];
+                confusion[0][j] = vessel_above;                                 //TP
+                confusion[1][j] = counts.background_total - background_above;   //TN
+                confusion[2][j] = background_above;                             //FP
+                confusion[3][j] = counts.vessel_total - vessel_above;           //FN
+            }
+
+            //precision - recall per threshold
+            for(int j = 0; j < 256; j++){
+                double tp = confusion[0][j];
+                precision[j] = (tp + confusion[2][j] > 0) ? tp / (tp + confusion[2][j]) : 0;
+                recall[j] = (tp + confusion[3][j] > 0) ? tp / (tp + confusion[3][j]) : 0;
+                f1[j] = (precision[j] + recall[j] > 0) ? 2*precision[j]*recall[j] / (precision[j] + recall[j]) : 0;
             }
         }
 
@@ -1141,6 +1246,30 @@ class ROC{
         double getArea(){
             return area;
         }
+
+        double getPrecision(int threshold){
+            return precision[threshold];
+        }
+
+        double getRecall(int threshold){
+            return recall[threshold];
+        }
+
+        double getF1(int threshold){
+            return f1[threshold];
+        }
+
+        /*best F1 score over every threshold, storing its threshold*/
+        double getBestF1(int* threshold = nullptr){
+            int best = 0;
+            for(int j = 1; j < 256; j++){
+                if(f1[j] > f1[best])
+                    best = j;
+            }
+            if(threshold != nullptr)
+                *threshold = best;
+            return f1[best];
+        }
  
         int getArraySize(){
             return elements.size();
@@ -1151,7 +1280,21 @@ class ROC{
         }
 };
 
+/*AUC of a single set of histograms, computed as ROC does for the whole dataset*/
+double histogramAUC(const ClassHistogram &hist){
+    ROC roc;
+    roc.addCounts(hist);
+    roc.calculateConfusionMatrix();
+    roc.calculateSensSpec();
+    roc.calculateAUC();
+    return roc.getArea();
+}
+
 //------------------------------------------Segmentation method based on adaptive local threshold
+/*local maxima windows of window_size + 1 pixels per side*/
+const int MAXIMA_ANCHOR_CORNER = 1;     //window starts at the pixel (down and right)
+const int MAXIMA_ANCHOR_CENTRE = 2;     //window centred on the pixel
+
 class Segment{
     private:
         vector<Image*> image;
@@ -1160,6 +1303,41 @@ class Segment{
         vector<Image*> segmented;
         double confusion[4];   //TP, TN, FP, FN 
 
+        /*intermediate Yanowitz results of one image, reused while sweeping maxima_t and connected_thresh*/
+        struct YanowitzStages{
+            Image* gradient = nullptr;                  //normalized gradient magnitude
+            map<int,int**> surface;                     //threshold surface per maxima_t
+            map<pair<int,bool>,int**> labels;           //component labels per segmentation (maxima_t, VisB)
+            map<pair<int,bool>,vector<ComponentStats>> stats;   //area, bounding box and centroid of every component label
+        };
+        vector<YanowitzStages> stages;
+        int stages_computed[3];                         //gradients, surfaces, labelings
+        int surface_solver;                             //SURFACE_SOR, SURFACE_MULTIGRID or SURFACE_RED_BLACK
+        double sor_omega;                               //red-black over-relaxation (0: optimal for the image size)
+        int surface_grid;                               //pixels per coarse surface cell (1: full resolution)
+        int surface_upsample;                           //UPSAMPLE_BILINEAR or UPSAMPLE_BICUBIC
+        double surface_seconds;                         //time spent in threshold surfaces since the last clearStages
+        int maxima_anchor;                              //MAXIMA_ANCHOR_CORNER or MAXIMA_ANCHOR_CENTRE
+
+        /*free every cached Yanowitz stage (images or masks changed)*/
+        void clearStages(){
+            for(int i = 0; i < (int)stages.size(); i++){
+                int rows = image[i]->getRows();
+                delete stages[i].gradient;
+                for(auto &entry : stages[i].surface){
+                    freeMatrix(entry.second,rows);
+                }
+                for(auto &entry : stages[i].labels){
+                    freeMatrix(entry.second,rows);
+                }
+            }
+            stages.clear();
+            stages_computed[0] = 0;
+            stages_computed[1] = 0;
+            stages_computed[2] = 0;
+            surface_seconds = 0;
+        }
+
     public:
 
     Segment(){
@@ -1167,10 +1345,21 @@ class Segment{
         confusion[1] = 0;
         confusion[2] = 0;
         confusion[3] = 0;
+        stages_computed[0] = 0;
+        stages_computed[1] = 0;
+        stages_computed[2] = 0;
+        surface_solver = SURFACE_SOR;
+        sor_omega = 0;
+        surface_grid = 1;
+        surface_upsample = UPSAMPLE_BILINEAR;
+        surface_seconds = 0;
+        maxima_anchor = MAXIMA_ANCHOR_CORNER;
         
     }
 
     ~Segment(){
+        clearStages();
+
         //free allocated memory for every enhanced and groundthruth image
         for(int i= 0; i<(int)image.size(); i++){
             delete image[i];
@@ -1200,6 +1389,7 @@ class Segment{
         if((int)mask.size() == n_images){
             return;
         }
+        clearStages();
 
         Image *ptr;
         for(int i = init_ref; i < init_ref + n_images; i++){
@@ -1232,6 +1422,18 @@ class Segment{
 
     }
 
+    /*share masks and groundtruth already in memory (not owned, never cleared through this object)*/
+    void setReferenceImages(const vector<Image*> &new_mask, const vector<Image*> &new_gt){
+        clearStages();
+        mask = new_mask;
+        groundtruth = new_gt;
+    }
+
+    /*append an image already in memory to the image array (owned)*/
+    void addImage(Image *img){
+        image.push_back(img);
+    }
+
     /*read images from dataset into an array; array_type = 1 for image array, array_type = 2 for segmented array*/
     void buildImageArray(string dataset_path, int n_images, int init_ref=1, int array_type = 1, int img_type = 1){
 
@@ -1243,6 +1445,8 @@ class Segment{
         if(img_type == 2){
             img_appendix = "_segmented.pgm";
         }
+        if(array_type == 1)
+            clearStages();
 
         Image *ptr;
         for(int i = init_ref; i < init_ref + n_images; i++){
@@ -1266,76 +1470,194 @@ class Segment{
     void yanowitz_method(int n_images, string save_path,int maxima_t, int connected_thresh){
         
         //--------------------------------------------------Image segmentation workflow
-        Image *ptr;
         bool VisB;
         cout<<"Vessel is Black? : ";
         cin>>VisB;
 
-        cout<<"Segmentando...";
+        yanowitzStaged(n_images,save_path,maxima_t,connected_thresh,VisB);
+    }
+
+    /*Yanowitz thresholding surface method reusing the stages of previous calls
+        the gradient is computed once per image, the threshold surface once per maxima_t
+        and the component labels once per segmentation, only the size filter runs on every call
+    */
+    void yanowitzStaged(int n_images, string save_path,int maxima_t, int connected_thresh, bool VisB){
+        Image *ptr;
+        if((int)stages.size() < n_images)
+            stages.resize(n_images);
+
+        //save_path = "" keeps every result in memory without console output (sweeps)
+        bool write = save_path.size() != 0;
+        if(write)
+            cout<<"Segmentando...";
         for(int i = 0; i< n_images; i++){
-            int** original_img = image[i]->getCopyImage();
-            int** img_mask = mask[i]->getCopyImage();
+            YanowitzStages &stage = stages[i];
+            int** original_img = image[i]->getImage();
+            int** img_mask = mask[i]->getImage();
             int rows = image[i]->getRows();
             int cols = image[i]->getCols();
             
-            //1. smooth
-            image[i]->gauss_filter(true);
-
-            //2. gradient
-            image[i]->scharr_gradient(true);
-            image[i]->normalize(nullptr,mask[i]->getImage());
-
-            //3. local maxima
-            
-            int** max_grad_mask = localMaxima(image[i]->getImage(),rows,cols,20,maxima_t);
-            image[i]->pgmWrite(save_path + to_string(i+db_init)+"_gradient_max.pgm","max local gradient image",max_grad_mask);
-
-            //4. Get original gray levels on local maxima
-            int** eval_max_mask = evaluateMaxima(original_img,max_grad_mask,rows,cols);
-            image[i]->pgmWrite(save_path + to_string(i+db_init)+"_potential.pgm","potential threshold points",eval_max_mask);
+            //1. smooth and 2. gradient, streamed without an intermediate smoothed image
+            if(stage.gradient == nullptr){
+                SourceNode source(original_img,rows,cols);
+                GaussNode smooth(&source);
+                ScharrNode gradient(&smooth);
+                stage.gradient = new Image();
+                stage.gradient->setImage(runPipeline(&gradient),rows,cols);
+                stage.gradient->normalize(nullptr,img_mask);
+                stages_computed[0]++;
+            }
 
-            //5. interpolate with SOR over laplace derivative
-            int** threshold_surface = interpolatePoints(eval_max_mask,rows,cols,1.5,3,1000);
-            image[i]->pgmWrite(save_path + to_string(i+db_init)+"_thresh_surf.pgm","threshold surface",threshold_surface);
+            if(stage.surface.count(maxima_t) == 0){
+                //3. local maxima
+                int** max_grad_mask = localMaxima(stage.gradient->getImage(),rows,cols,20,maxima_t,maxima_anchor);
+                if(write)
+                    image[i]->pgmWrite(save_path + to_string(i+db_init)+"_gradient_max.pgm","max local gradient image",max_grad_mask);
+
+                //4. Get original gray levels on local maxima
+                int** eval_max_mask = evaluateMaxima(original_img,max_grad_mask,rows,cols);
+                if(write)
+                    image[i]->pgmWrite(save_path + to_string(i+db_init)+"_potential.pgm","potential threshold points",eval_max_mask);
+
+                //5. interpolate with SOR over laplace derivative
+                stage.surface[maxima_t] = thresholdSurface(eval_max_mask,rows,cols,write);
+                if(write)
+                    image[i]->pgmWrite(save_path + to_string(i+db_init)+"_thresh_surf.pgm","threshold surface",stage.surface[maxima_t]);
+                stages_computed[1]++;
+
+                freeMatrix(max_grad_mask,rows);
+                freeMatrix(eval_max_mask,rows);
+            }
 
-            //6. Apply threshold surface 
-            int** segmented_img = segmentImage(original_img,threshold_surface,img_mask,rows,cols,VisB);
+            //6. Apply threshold surface and label connected elements
+            pair<int,bool> key(maxima_t,VisB);
+            if(stage.labels.count(key) == 0){
+                int** thresholded = segmentImage(original_img,stage.surface[maxima_t],img_mask,rows,cols,VisB);
+                stage.labels[key] = labelComponents(thresholded,rows,cols,stage.stats[key]);
+                stages_computed[2]++;
+                freeMatrix(thresholded,rows);
+            }
 
-            //7. Apply connected elements algorithm to keep objects > threshold
-            connected_BFS(segmented_img,rows,cols,connected_thresh);
-            cout<<save_path + to_string(i)+"_segmented.pgm"<<endl;
-            image[i]->pgmWrite(save_path + to_string(i+db_init)+"_segmented.pgm","post processed image segmented with Yanowitz threshold surface",segmented_img,rows,cols);
+            //7. keep objects > threshold
+            int** segmented_img = filterComponents(stage.labels[key],stage.stats[key],rows,cols,connected_thresh);
+            if(write){
+                cout<<save_path + to_string(i)+"_segmented.pgm"<<endl;
+                image[i]->pgmWrite(save_path + to_string(i+db_init)+"_segmented.pgm","post processed image segmented with Yanowitz threshold surface",segmented_img,rows,cols);
+            }
 
             //store segmented image
             ptr = new Image();
             ptr->setImage(segmented_img,rows,cols);
             // add image object to vector
             segmented.push_back(ptr);
-            
-            //clear allocated images
-            delete max_grad_mask[0];
-            delete max_grad_mask;
-            delete eval_max_mask[0];
-            delete eval_max_mask;
-            delete threshold_surface[0];
-            delete threshold_surface;
-            delete original_img[0];
-            delete original_img;
-            delete img_mask[0];
-            delete img_mask;
+        }
+        if(write)
+            cout<<"\nProceso finalizado\n";
+    }
+
+    /*select the threshold surface solver (SURFACE_SOR, SURFACE_MULTIGRID, SURFACE_RED_BLACK with omega)
+        cached surfaces are dropped when it changes
+    */
+    void setSurfaceSolver(int solver, double omega = 0){
+        if(solver != surface_solver || omega != sor_omega)
+            clearStages();
+        surface_solver = solver;
+        sor_omega = omega;
+        if(surface_grid > 1 && surface_solver == SURFACE_SOR)
+            cout<<"Warning: coarse surface grid ignored with the SOR solver, select multigrid or red-black SOR"<<endl;
+    }
+
+    /*solve threshold surfaces on a grid of factor x factor pixel cells, upsampled with UPSAMPLE_BILINEAR or UPSAMPLE_BICUBIC
+        only for converged solvers: the legacy SURFACE_SOR stays at full resolution (its early stop depends on the pixel size)
+        cached surfaces are dropped when it changes
+    */
+    void setSurfaceGrid(int factor, int upsample = UPSAMPLE_BILINEAR){
+        factor = max(factor,1);
+        if(factor != surface_grid || upsample != surface_upsample)
+            clearStages();
+        surface_grid = factor;
+        surface_upsample = upsample;
+        if(surface_grid > 1 && surface_solver == SURFACE_SOR)
+            cout<<"Warning: coarse surface grid ignored with the SOR solver, select multigrid or red-black SOR"<<endl;
+    }
+
+    /*true when surfaces are solved on the coarse grid*/
+    bool coarseSurface(){
+        return surface_grid > 1 && surface_solver != SURFACE_SOR;
+    }
+
+    /*anchor of the local maxima windows (MAXIMA_ANCHOR_CORNER or MAXIMA_ANCHOR_CENTRE), cached surfaces are dropped when it changes*/
+    void setMaximaAnchor(int anchor){
+        if(anchor != maxima_anchor)
+            clearStages();
+        maxima_anchor = anchor;
+    }
+
+    /*seconds spent interpolating threshold surfaces since the stages were last cleared*/
+    double surfaceSeconds(){
+        return surface_seconds;
+    }
+
+    /*threshold surface through potential points, pooled onto the coarse surface grid when it is used*/
+    int** thresholdSurface(int** points, int rows, int cols, bool verbose = false){
+        auto start = chrono::steady_clock::now();
+        int** surface;
+        if(!coarseSurface()){
+            surface = solveSurface(points,rows,cols,surface_solver,verbose);
+        }else{
+            int c_rows, c_cols;
+            int** coarse_points = poolPoints(points,rows,cols,surface_grid,c_rows,c_cols);
+            int** coarse_surface = solveSurface(coarse_points,c_rows,c_cols,surface_solver,verbose);
+            surface = upsampleSurface(coarse_surface,c_rows,c_cols,surface_grid,0,rows,cols,surface_upsample);
+            freeMatrix(coarse_points,c_rows);
+            freeMatrix(coarse_surface,c_rows);
+        }
+        surface_seconds += chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        return surface;
+    }
 
+    /*threshold surface through potential points with solver (SURFACE_SOR, SURFACE_MULTIGRID or SURFACE_RED_BLACK), verbose prints the solver residuals*/
+    int** solveSurface(int** points, int rows, int cols, int solver, bool verbose = false){
+        if(solver == SURFACE_MULTIGRID){
+            SurfaceReport report;
+            int** surface = multigridSurface(points,rows,cols,0.5,50,&report);
+            if(verbose){
+                cout<<"multigrid V-cycles: "<<report.iterations<<", max residual per cycle:";
+                for(int k = 0; k < (int)report.residuals.size(); k++){
+                    cout<<" "<<report.residuals[k];
+                }
+                cout<<endl;
+            }
+            return surface;
         }
-        cout<<"\nProceso finalizado\n";
+
+        if(solver == SURFACE_RED_BLACK){
+            SurfaceReport report;
+            int** surface = redBlackSORSurface(points,rows,cols,sor_omega,0.5,5000,&report);
+            if(verbose && report.iterations > 0){
+                cout<<"red-black SOR omega "<<(sor_omega > 0 ? sor_omega : optimalOmega(rows,cols))<<": "<<report.iterations;
+                cout<<" sweeps, max residual "<<report.residuals.front()<<" -> "<<report.residuals.back()<<endl;
+            }
+            return surface;
+        }
+
+        return interpolatePoints(points,rows,cols,1.5,3,1000);
+    }
+
+    /*print how many Yanowitz stages were computed (the rest were reused)*/
+    void printStageCounts(){
+        cout<<"Yanowitz stages computed: gradients "<<stages_computed[0]<<", surfaces "<<stages_computed[1]<<", labelings "<<stages_computed[2]<<endl;
     }
 
-    /*Segment a series of images using iterative thresholding method*/
-    void iterative_method(int n_images, string save_path, int c_thresh){
+    /*Segment a series of images using a global threshold from each image histogram
+        method = 1: iterative (Ridler-Calvard), method = 2: Otsu
+    */
+    void iterative_method(int n_images, string save_path, int c_thresh, int method = 1){
         
         //--------------------------------------------------Image segmentation workflow
         Image *ptr;
-        int** img_background;
         int** img_foreground;
-        int threshold = 0,threshold_new;
+        int threshold;
         int rows = image[0]->getRows();
         int cols = image[0]->getCols();
 
@@ -1346,38 +1668,28 @@ class Segment{
         cout<<"Segmentando...";
 
         for(int i = 0; i< n_images; i++){
-            //normalize image
-            image[i]->normalize(nullptr, mask[i]->getImage());
-            //1. initial threshold from image mean
-            threshold_new = image[i]->mean(nullptr, mask[i]->getImage());
-            
-            while(abs(threshold - threshold_new) > 1){
-                //update threshold
-                threshold = threshold_new;
-
-                //2. apply threshold to get background and foreground
-                img_foreground = image[i]->getImageFromMask(threshold,true);
-                image[i]->pgmWrite(save_path + to_string(i+db_init)+"_foreground.pgm","image segmented with iterative threshold method",img_foreground,rows,cols);
+            //normalize a copy, so cached Yanowitz stages keep matching the image array
+            Image normalized;
+            normalized.setImage(image[i]->getCopyImage(),rows,cols);
+            normalized.normalize(nullptr, mask[i]->getImage());
 
-                img_background = image[i]->getImageFromMask(threshold,false);
-                image[i]->pgmWrite(save_path + to_string(i+db_init)+"_background.pgm","image segmented with iterative threshold method",img_foreground,rows,cols);
+            //1. masked histogram of normalized image
+            ImageStats stats = normalized.statistics(mask[i]->getImage());
 
-                //3. Compute new threshold from mean of foreground and background images
-                threshold_new = (image[i]->mean(img_foreground, mask[i]->getImage()) + image[i]->mean(img_background, mask[i]->getImage())) / 2;
+            //2. threshold selection over histogram
+            if(method == 2)
+                threshold = otsuThreshold(stats.histogram);
+            else
+                threshold = iterativeThreshold(stats.histogram);
 
-                delete img_background[i];
-                delete img_background;
-                delete img_foreground[i];
-                delete img_foreground;
-            }
             //segment using best estimated threshold
-            img_foreground = segmentImage(image[i]->getImage(),threshold_new,mask[i]->getImage(),rows,cols,VisB);
+            img_foreground = segmentImage(normalized.getImage(),threshold,mask[i]->getImage(),rows,cols,VisB);
 
 
             //7. Apply connected elements algorithm
-            connected_BFS(img_foreground,rows,cols,c_thresh);
+            connectedComponents(img_foreground,rows,cols,c_thresh);
             cout<<save_path + to_string(i)+"_segmented.pgm"<<endl;
-            image[i]->pgmWrite(save_path + to_string(i+db_init)+"_segmented.pgm","image segmented with iterative threshold method",img_foreground,rows,cols);
+            image[i]->pgmWrite(save_path + to_string(i+db_init)+"_segmented.pgm","image segmented with " + string(method == 2 ? "Otsu" : "iterative") + " threshold method",img_foreground,rows,cols);
 
             //store segmented image
             ptr = new Image();
@@ -1429,34 +1741,97 @@ class Segment{
         }
     }
 
-    /*Create binary mask of local maxima over graddient image*/
-    int** localMaxima(int** grad_image,int rows, int cols, int window_size, int threshold){
+    /*running max of n values over the windows [i - before, i + after] clipped to 0 .. n-1, before + after < len
+        van Herk / Gil-Werman: prefix (g) and suffix (h) maxima of blocks of len values, two of them cover any window
+    */
+    static void runningMax(const long long *in, long long *out, long long *g, long long *h, int n, int len, int before, int after){
+        for(int i = 0; i < n; i++){
+            g[i] = (i % len == 0) ? in[i] : max(g[i-1],in[i]);
+        }
+        for(int i = n-1; i >= 0; i--){
+            h[i] = (i % len == len-1 || i == n-1) ? in[i] : max(h[i+1],in[i]);
+        }
+        for(int i = 0; i < n; i++){
+            int s = max(i - before,0);
+            int e = min(i + after,n-1);
+            if(s/len != e/len)
+                out[i] = max(h[s],g[e]);
+            else
+                out[i] = (s % len == 0) ? g[e] : h[s];
+        }
+    }
+
+    /*Create binary mask of local maxima over graddient image
+        every window of (window_size+1)^2 pixels (clipped at the borders) marks its max if it is >= threshold,
+        ties go to the first pixel in row-major order; windows anchored by MAXIMA_ANCHOR_CORNER or MAXIMA_ANCHOR_CENTRE
+        separable running max (rows, then columns) at constant cost per pixel for any window size
+    */
+    int** localMaxima(int** grad_image,int rows, int cols, int window_size, int threshold, int anchor = MAXIMA_ANCHOR_CORNER){
         int** grad_max = createMatrix(rows,cols,0);
-        int max_yx[2] = {0,0};
-
-        //iterator over window 
-        for ( int y = 0; y < rows; y++ ){
-            for ( int x = 0; x < cols; x++ ){
-                //reset max values
-                max_yx[0] = y;
-                max_yx[1] = x;
-                //filter window coordinates
-                for(int i = y; i <= y + window_size; i++){
-                    for(int j = x; j <= x + window_size; j++){
-                        //exclude non fitting filter pixels
-                        if((i>=rows) || (j>=cols)){
-                            break;
-                        }
-                        //evaluate max value in local window
-                        if(grad_image[max_yx[0]][max_yx[1]] < grad_image[i][j]){
-                            max_yx[0] = i;
-                            max_yx[1] = j;
-                        }
-                    }
+        long long n = (long long)rows*cols;
+        int len = window_size + 1;
+        int before = (anchor == MAXIMA_ANCHOR_CENTRE) ? window_size/2 : 0;
+        int after = window_size - before;
+
+        //gray level first, lower row-major index breaks ties
+        vector<long long> key(n), row_max(n), g(n), h(n);
+        for(int y = 0; y < rows; y++){
+            for(int x = 0; x < cols; x++){
+                long long p = (long long)y*cols + x;
+                key[p] = grad_image[y][x]*n + (n-1-p);
+            }
+        }
+
+        //1. max over the window of every row
+        for(int y = 0; y < rows; y++){
+            size_t r = (size_t)y*cols;
+            runningMax(&key[r],&row_max[r],&g[r],&h[r],cols,len,before,after);
+        }
+
+        //2. max over the window of every column, blocks of len rows processed a whole row at a time
+        for(int y = 0; y < rows; y++){
+            const long long *in = &row_max[(size_t)y*cols];
+            long long *g_row = &g[(size_t)y*cols];
+            if(y % len == 0){
+                copy(in,in + cols,g_row);
+            }else{
+                const long long *g_up = g_row - cols;
+                for(int x = 0; x < cols; x++){
+                    g_row[x] = max(g_up[x],in[x]);
                 }
+            }
+        }
+        for(int y = rows-1; y >= 0; y--){
+            const long long *in = &row_max[(size_t)y*cols];
+            long long *h_row = &h[(size_t)y*cols];
+            if(y % len == len-1 || y == rows-1){
+                copy(in,in + cols,h_row);
+            }else{
+                const long long *h_down = h_row + cols;
+                for(int x = 0; x < cols; x++){
+                    h_row[x] = max(h_down[x],in[x]);
+                }
+            }
+        }
+
+        //3. mark the max of every window
+        for(int y = 0; y < rows; y++){
+            int s = max(y - before,0);
+            int e = min(y + after,rows-1);
+            const long long *h_row = &h[(size_t)s*cols];
+            const long long *g_row = &g[(size_t)e*cols];
+            for(int x = 0; x < cols; x++){
+                long long window_max;
+                if(s/len != e/len)
+                    window_max = max(h_row[x],g_row[x]);
+                else
+                    window_max = (s % len == 0) ? g_row[x] : h_row[x];
 
-                if(grad_image[max_yx[0]][max_yx[1]]  >= threshold)
-                    grad_max[max_yx[0]][max_yx[1]] = 255;
+                long long p = n-1 - ((window_max % n) + n) % n;
+                int i = p / cols;
+                int j = p % cols;
+                if(grad_image[i][j] >= threshold)
+                    grad_max[i][j] = 255;
             }
         }
 
@@ -1548,64 +1923,28 @@ class Segment{
         return segmented_img;
     }
 
-    /*Apply Breadth first search for connected elements detection*/
-    void connected_BFS(int** img, int rows, int cols, int size_threshold){
-        //matrix of labeled pixels
-        int** connected_map = createMatrix(rows,cols,0);
-        //element label id
-        int label = 1;
-        //array of connected elements
-        queue<vector<int>> queue_connect;
-        //count of connected elements
-        vector<int> vector_connect;
-        int c_x,c_y;
-        
-        //labeling pixels
-        for ( int y = 0; y < rows; y++ ){
-            for ( int x = 0; x < cols; x++ ){
-                //check for already visited pixels or background
-                if(connected_map[y][x] != 0 || img[y][x]== 0){
-                    continue;
-                }
-
-                //enqueue unvisited pixel
-                queue_connect.push({y,x});
-
-                //set new label
-                connected_map[y][x] = label;
-                //store new label in vector count
-                vector_connect.push_back(1);
-                label++;
-
-                //evaluate neighborhood from queue
-                while(!queue_connect.empty()){
-                    c_y = queue_connect.front()[0];
-                    c_x = queue_connect.front()[1];
-                    queue_connect.pop();
-
-                    for(int i= c_y-1; i <= c_y+1; i++){
-                        for(int j = c_x-1; j <= c_x+1; j++){
-                            //exclude non fitting filter pixels, already visited or background
-                            if((i<0) || (j<0) || (i>=rows) || (j>=cols) || (connected_map[i][j]!=0) || (img[i][j]==0)){
-                                continue;
-                            }
-                            
-                            //set same label as center
-                            connected_map[i][j] = connected_map[c_y][c_x];
-                            //add neighbor to queue
-                            queue_connect.push({i,j});
-                            vector_connect[label-2]++; 
-                        }
-                    }
-                }
+    /*binary image keeping labeled elements with area >= size_threshold*/
+    int** filterComponents(int** labels, const vector<ComponentStats> &stats, int rows, int cols, int size_threshold){
+        int** filtered = createMatrix(rows,cols,0);
+        for( int y = 0; y < rows; y++){
+            for ( int x = 0; x < cols; x++){
+                if(labels[y][x] != 0 && stats[labels[y][x]-1].area >= size_threshold)
+                    filtered[y][x] = 255;
             }
         }
+        return filtered;
+    }
+
+    /*keep 8-connected elements with area >= size_threshold (union-find labelling)*/
+    void connectedComponents(int** img, int rows, int cols, int size_threshold){
+        vector<ComponentStats> stats;
+        int** connected_map = labelComponents(img,rows,cols,stats);
 
         //keep connected elements with length > threshold
         for( int y = 0; y < rows; y++){
             for ( int x = 0; x < cols; x++){
                 if(connected_map[y][x] != 0){
-                    if((vector_connect[connected_map[y][x]-1] >=  size_threshold))
+                    if(stats[connected_map[y][x]-1].area >= size_threshold)
                         img[y][x] = 255;
                     else
                         img[y][x] = 0;
@@ -1614,119 +1953,17 @@ class Segment{
             }
         }
 
-        delete connected_map[0];
-        delete connected_map;
+        freeMatrix(connected_map,rows);
     }
 
     /*Thin white elements from binary images using Zhang-Suen algorithm*/
     void zhangSuenSkeletonization(){
         
         string save_path_skeleton = "src/db_coronary/skeletonized/";
-        bool change_flag;   //changes made during any of both phases
-        bool BtoW_change;   //transition from black too white
-        int** image_ptr;
-        int count_b,count_a;
 
         for(int n = 0; n < (int)image.size(); n++){
-            image_ptr = image[n]->getImage();
-            change_flag = true;
-
-            while(change_flag){
-
-                change_flag = false;
-                /* order of window elements:
-                    9 2 3
-                    8 1 4
-                    7 6 5
-                */
-               //phase 1
-                for(int i = 1; i < image[n]->getRows() - 1; i++){
-                    for(int j = 1; j < image[n]->getCols() - 1; j++){
-                        if(image_ptr[i][j] == 255){
-                            
-                            int window[9][2] = {{i-1,j},{i-1,j+1},{i,j+1},{i+1,j+1},{i+1,j},{i+1,j-1},{i,j-1},{i-1,j-1},{i-1,j}};
-                            
-                            //1. Count number of white neighbour pixels
-                            count_b = 0;
-                            for(int k=0; k<8; k++){
-                                if(image_ptr[window[k][0]][window[k][1]] == 255)
-                                    count_b++; 
-                            }
-                            if(count_b < 2 || count_b > 6)
-                                continue;
-                            
-                            //2. Count number of black -> white transitions (closing circle in window 2,3,...,2)
-                            count_a = 0;
-                            for(int k=0; k<9; k++){
-                                if(image_ptr[window[k][0]][window[k][1]] == 0)
-                                    BtoW_change = true;
-                                else if(BtoW_change && image_ptr[window[k][0]][window[k][1]] == 255){
-                                    BtoW_change = false;
-                                    count_a++;
-                                }
-                                     
-                            }
-                            if(count_a != 1)
-                                continue;
-    
-                            //3. check for at least 2,4,6 are black pixels
-                            if(image_ptr[window[0][0]][window[0][1]] *image_ptr[window[2][0]][window[2][1]] * image_ptr[window[4][0]][window[4][1]] != 0)
-                                continue;
-                            
-                            //4. check for at least 4,6,8 are black pixels
-                            if(image_ptr[window[6][0]][window[6][1]] *image_ptr[window[2][0]][window[2][1]] * image_ptr[window[4][0]][window[4][1]] != 0)
-                                continue;
-                            
-                            //set 0 in current pixel
-                            image_ptr[i][j] = 0;   
-                            change_flag = true;
-                        }
-                    }
-                }
-    
-                //phase 2
-                for(int i = 1; i < image[n]->getRows()-1; i++){
-                    for(int j = 1; j < image[n]->getCols()-1; j++){
-                        if(image_ptr[i][j] == 255){
-                            int window[9][2] = {{i-1,j},{i-1,j+1},{i,j+1},{i+1,j+1},{i+1,j},{i+1,j-1},{i,j-1},{i-1,j-1},{i-1,j}};
-                            
-                            //1. Count number of white neighbour pixels
-                            count_b = 0;
-                            for(int k=0; k<8; k++){
-                                if(image_ptr[window[k][0]][window[k][1]] == 255)
-                                    count_b++; 
-                            }
-                            if(count_b < 2 || count_b > 6)
-                                continue;
-                            
-                            //2. Count number of black -> white transitions (closing circle in window 2,3,...,2)
-                            count_a = 0;
-                            for(int k=0; k<9; k++){
-                                if(image_ptr[window[k][0]][window[k][1]] == 0)
-                                    BtoW_change = true;
-                                else if(BtoW_change && image_ptr[window[k][0]][window[k][1]] == 255){
-                                    BtoW_change = false;
-                                    count_a++;
-                                }
-                            }
-                            if(count_a != 1)
-                                continue;
-    
-                            //3. check for at least 2,4,8 are black pixels
-                            if(image_ptr[window[0][0]][window[0][1]] *image_ptr[window[2][0]][window[2][1]] * image_ptr[window[6][0]][window[6][1]] != 0)
-                                continue;
-                            
-                            //4. check for at least 2,6,8 are black pixels
-                            if(image_ptr[window[0][0]][window[0][1]] *image_ptr[window[4][0]][window[4][1]] * image_ptr[window[6][0]][window[6][1]] != 0)
-                                continue;
-                            
-                            //set 0 in current pixel
-                            image_ptr[i][j] = 0;   
-                            change_flag = true;
-                        }
-                    }
-                }
-            }
+            //both phases evaluated over previous state until no pixel changes
+            zhangSuenThinning(image[n]->getImage(),image[n]->getRows(),image[n]->getCols());
 
             //save into folder
             cout<<save_path_skeleton + to_string(n + db_init) +"_skeleton.pgm"<<endl;
@@ -1736,8 +1973,146 @@ class Segment{
         
     }
 
+    /*Yanowitz segmentation of a single large image streamed in bands of band_rows rows (files are never fully loaded)
+        1. gradient min/max inside mask, 2. local maxima per band pooled into a coarse grid (grid_factor pixels per cell)
+        3. threshold surface interpolated on the coarse grid, 4. upsampled surface per band to segment, 5. streamed connected elements
+        the coarse grid (rows/grid_factor x cols/grid_factor) is held in memory for the whole image, grid_factor is raised
+        until it fits in one band (band_rows x cols), so memory stays bounded by the band size
+    */
+    int yanowitzTiled(string image_file, string mask_file, string output_file, int maxima_t, int connected_thresh, int band_rows, bool VisB, int grid_factor = 1){
+        int window_size = 20;
+        vector<string> inputs = {image_file, mask_file};
+
+        PGMRowReader header;
+        if(!header.open(image_file))
+            return 0;
+        int rows = header.getRows();
+        int cols = header.getCols();
+        header.close();
+
+        long long band_size = (long long)max(band_rows,1)*cols;
+        int min_factor = 1;
+        while((long long)((rows + min_factor - 1)/min_factor)*((cols + min_factor - 1)/min_factor) > band_size)
+            min_factor++;
+        if(grid_factor < min_factor){
+            cout<<"Warning: surface grid factor raised to "<<min_factor<<" to keep the coarse grid within one band"<<endl;
+            grid_factor = min_factor;
+        }
+
+        //1. gradient range inside mask (gauss + scharr need 3 rows above and below)
+        int grad_min = INT_MAX, grad_max = INT_MIN;
+        mutex stats_lock;
+        int ok = processBands(inputs,"",band_rows,3,[&](const vector<int**> &in, int n_rows, int n_cols, int, int band_begin, int band_end) -> int**{
+            SourceNode source(in[0],n_rows,n_cols);
+            GaussNode smooth(&source);
+            ScharrNode gradient(&smooth);
+            int band_min = INT_MAX, band_max = INT_MIN;
+            for(int y = band_begin; y < band_end; y++){
+                const int* g = gradient.row(y);
+                for(int x = 0; x < n_cols; x++){
+                    if(in[1][y][x] == 0)
+                        continue;
+                    band_min = min(band_min,g[x]);
+                    band_max = max(band_max,g[x]);
+                }
+            }
+            lock_guard<mutex> guard(stats_lock);
+            grad_min = min(grad_min,band_min);
+            grad_max = max(grad_max,band_max);
+            return nullptr;
+        });
+        if(!ok)
+            return 0;
+
+        //2. potential threshold points pooled (mean gray level) into coarse grid cells
+        int c_rows = (rows + grid_factor - 1)/grid_factor;
+        int c_cols = (cols + grid_factor - 1)/grid_factor;
+        vector<long long> cell_sum((size_t)c_rows*c_cols,0);
+        vector<int> cell_count((size_t)c_rows*c_cols,0);
+        int halo = window_size + 3;
+        ok = processBands(inputs,"",band_rows,halo,[&](const vector<int**> &in, int n_rows, int n_cols, int first_row, int band_begin, int band_end) -> int**{
+            SourceNode source(in[0],n_rows,n_cols);
+            GaussNode smooth(&source);
+            ScharrNode gradient(&smooth);
+            int** grad = runPipeline(&gradient);
+
+            //same normalization as Image::normalize with global range
+            for(int y = 0; y < n_rows; y++){
+                for(int x = 0; x < n_cols; x++){
+                    if(in[1][y][x] == 0 || grad_max <= grad_min)
+                        grad[y][x] = 0;
+                    else
+                        grad[y][x] = round((grad[y][x] - grad_min)*(255)/ (grad_max-grad_min));
+                }
+            }
+
+            int** max_grad_mask = localMaxima(grad,n_rows,n_cols,window_size,maxima_t,maxima_anchor);
+            int** eval_max_mask = evaluateMaxima(in[0],max_grad_mask,n_rows,n_cols);
+
+            {
+                lock_guard<mutex> guard(stats_lock);
+                for(int y = band_begin; y < band_end; y++){
+                    int c_y = (first_row + y)/grid_factor;
+                    for(int x = 0; x < n_cols; x++){
+                        if(eval_max_mask[y][x] == 0)
+                            continue;
+                        size_t c = (size_t)c_y*c_cols + x/grid_factor;
+                        cell_sum[c] += eval_max_mask[y][x];
+                        cell_count[c]++;
+                    }
+                }
+            }
+
+            freeMatrix(grad,n_rows);
+            freeMatrix(max_grad_mask,n_rows);
+            freeMatrix(eval_max_mask,n_rows);
+            return nullptr;
+        });
+        if(!ok)
+            return 0;
+
+        //3. interpolate the threshold surface over the coarse grid
+        int** coarse_points = createMatrix(c_rows,c_cols,0);
+        for(int i = 0; i < c_rows; i++){
+            for(int j = 0; j < c_cols; j++){
+                size_t c = (size_t)i*c_cols + j;
+                if(cell_count[c] > 0)
+                    coarse_points[i][j] = cell_sum[c]/cell_count[c];
+            }
+        }
+        //same rule as coarseSurface: the legacy SOR early stop depends on the pixel size, coarse grids need a converged solver
+        int solver = surface_solver;
+        if(grid_factor > 1 && solver == SURFACE_SOR){
+            cout<<"Warning: SOR does not converge on the coarse surface grid, solving with multigrid"<<endl;
+            solver = SURFACE_MULTIGRID;
+        }
+        int** coarse_surface = solveSurface(coarse_points,c_rows,c_cols,solver,true);
+
+        //4. upsampled threshold surface per band and segmentation inside mask
+        string temp_file = output_file + ".tmp";
+        ok = processBands(inputs,temp_file,band_rows,0,[&](const vector<int**> &in, int n_rows, int n_cols, int first_row, int, int) -> int**{
+            int** surface = upsampleSurface(coarse_surface,c_rows,c_cols,grid_factor,first_row,n_rows,n_cols,surface_upsample);
+            int** segmented_band = segmentImage(in[0],surface,in[1],n_rows,n_cols,VisB);
+            freeMatrix(surface,n_rows);
+            return segmented_band;
+        },0,"image segmented with Yanowitz threshold surface");
+
+        freeMatrix(coarse_points,c_rows);
+        freeMatrix(coarse_surface,c_rows);
+        if(!ok)
+            return 0;
+
+        //5. keep objects > threshold
+        ok = connectedComponentsStream(temp_file,output_file,connected_thresh);
+        remove(temp_file.c_str());
+        return ok;
+    }
+
     /*reset enhanced image array and confusion matrix values*/
     void clearArray(int array_type){
+        if(array_type == 1 || array_type == 2)
+            clearStages();
+
         if(array_type == 1 && (int)image.size() > 0 ){
             for(int i= 0; i<(int)image.size(); i++){
                 delete image[i];
@@ -1787,6 +2162,11 @@ class Segment{
         cout<<"Recall           "<<recall<<endl;
     }
 
+    /*F1-score (dice) of the accumulated confusion matrix*/
+    double f1Score(){
+        return 2*confusion[0] / (2*confusion[0] + confusion[2] + confusion[3]);
+    }
+
     /*print formated data from ROC  testing*/
     void printROCData(string method, string params){
         float dice = 2*confusion[0] / (2*confusion[0] + confusion[2] + confusion[3]);
@@ -1916,85 +2296,459 @@ int** createGMFkernel(int* gmf_params, int extra_L = 4, int extra_T = 6){
     return kernel_fit;
 }
 
-/*create binary descriptor from initial structure and change percentage*/
-int** randomBinaryDescriptor(int** initial_strel, int change_percent, int radius){
+/*state shared by every local search of a run: seeded generator and AUC of every strel already evaluated*/
+struct StrelSearch{
+    unsigned int seed;
+    mt19937 rng;
+    unordered_map<uint64_t,double> memo;    //strel hash -> mean per image AUC
+    int evaluations = 0;
+    int repeats = 0;                        //candidates skipped because they were already evaluated
+    int abandoned = 0;                      //candidates rejected by racing before the last image
+    int images_skipped = 0;                 //image evaluations saved by racing
+
+    //pyramid screening: candidates are scored on the dataset downsampled by pyramid_factor (0: disabled)
+    int pyramid_factor = 0;
+    double promote_fraction = 0.25;         //best fraction of each batch scored at full resolution
+    int calibration_every = 10;             //every n-th batch promotes every candidate to compare rankings
+    int coarse_evaluations = 0;
+    vector<double> coarse_scores;           //calibration pairs of coarse and full resolution mean per image AUC
+    vector<double> fine_scores;
+    int batches = 0;
+
+    /*seed = 0 takes a random seed (printed to reproduce the run)*/
+    StrelSearch(unsigned int search_seed = 0){
+        seed = (search_seed != 0) ? search_seed : random_device()();
+        rng.seed(seed);
+    }
+};
+
+/*canonical hash of a strel (FNV-1a over radius and binarized cells in row order)*/
+uint64_t strelHash(int** strel, int radius){
+    uint64_t hash = 1469598103934665603ULL;
+    auto mix = [&hash](uint64_t value){
+        hash ^= value;
+        hash *= 1099511628211ULL;
+    };
+
+    mix(radius);
+    for(int i = 0; i < radius*2+1; i++){
+        for(int j = 0; j < radius*2+1; j++){
+            mix(strel[i][j] != 0);
+        }
+    }
+    return hash;
+}
+
+/*create binary descriptor from initial structure and change percentage using the search generator*/
+int** randomBinaryDescriptor(int** initial_strel, int change_percent, int radius, mt19937 &rng){
 
     //create binary descriptor from initial structure
     int** strel = copyImage(initial_strel,radius*2+1,radius*2+1);
-    //initiallize random generator
-    srand(time(0));
     //pixel coordinates to change
     int x,y;
+    uniform_int_distribution<int> coordinate(0,radius*2);
+    uniform_int_distribution<int> bit(0,1);
     //number of pixel changes
     int n_changes = (int)((change_percent/100.0) * (radius*2+1)*(radius*2+1));
     for(int i = 0; i < n_changes; i++){
-        x = rand() % (radius*2+1);
-        y = rand() % (radius*2+1);
-        strel[x][y] = rand() % 2;
+        x = coordinate(rng);
+        y = coordinate(rng);
+        strel[x][y] = bit(rng);
     }
 
     return strel;
 }
 
 
-/*evaluate strel with whole dataset, returning its AUC and save images*/
-void addStrelEvaluation(ROC* roc_curve, int** strel, string strel_name, int strel_param[], int enhancetype){
-    //image operation result
-    int **img_bright;
-    int **img_dim;
-
-    //image object pointer
-    Image *img;
+/*append enhancement nodes after input, returning the last node of the chain
+    enhancetype = 1: image - tophat, enhancetype = 2: image + tophat - blackhat
+    n_passes enhancements are chained, optionally after gaussian smoothing and before inversion
+*/
+RowNode* buildEnhancePipeline(vector<unique_ptr<RowNode>> &nodes, RowNode* input, int** strel, int strel_radius, int enhancetype, int n_passes = 1, bool smooth = false, bool invert = false){
+    RowNode* last = input;
 
-    //pgm descriptor
-    string pgm_desc;
-    if(enhancetype == 1)
-        pgm_desc = "image - topkhat, ";
-    else
-        pgm_desc = "image + tophat - blackhat, ";
+    if(smooth){
+        last = new GaussNode(last);
+        nodes.push_back(unique_ptr<RowNode>(last));
+    }
 
+    for(int p = 0; p < n_passes; p++){
+        RowNode* pass_input = last;
 
-    for(int i = db_init; i < db_init + db_size; i++){
-        // Read image
-        img = new Image();
-        //build path to image 
-        img->pgmRead(db_path + to_string(i) +"_training.pgm");
+        //tophat: image - opening
+        RowNode* open_erosion = new MorphNode(pass_input,strel,strel_radius,MORPH_EROSION);
+        RowNode* opening = new MorphNode(open_erosion,strel,strel_radius,MORPH_DILATION);
+        RowNode* tophat = new CombineNode(pass_input,opening,COMBINE_DIFF);
+        nodes.push_back(unique_ptr<RowNode>(open_erosion));
+        nodes.push_back(unique_ptr<RowNode>(opening));
+        nodes.push_back(unique_ptr<RowNode>(tophat));
 
-        //Apply morphological operations
         if(enhancetype == 1){
-            //enhance original image by decreasing light (image - blackhat)
-            img_bright = img->morphOp("tophat",strel,strel_param[3]);
-            img->diffImage(img_bright);
-
+            //enhance original image by decreasing light (image - tophat)
+            last = new CombineNode(pass_input,tophat,COMBINE_DIFF);
+            nodes.push_back(unique_ptr<RowNode>(last));
         }else{
+            //blackhat: closing - image
+            RowNode* close_dilation = new MorphNode(pass_input,strel,strel_radius,MORPH_DILATION);
+            RowNode* closing = new MorphNode(close_dilation,strel,strel_radius,MORPH_EROSION);
+            RowNode* blackhat = new CombineNode(closing,pass_input,COMBINE_DIFF);
+            nodes.push_back(unique_ptr<RowNode>(close_dilation));
+            nodes.push_back(unique_ptr<RowNode>(closing));
+            nodes.push_back(unique_ptr<RowNode>(blackhat));
+
             //enhance original image by increasing contrast (image + tophat - blackhat)
-            img_bright = img->morphOp("tophat",strel,strel_param[3]);
-            img_dim = img->morphOp("blackhat",strel,strel_param[3]); 
-            img->addImage(img_bright);
-            img->diffImage(img_dim);
-            delete img_dim[0];
-            delete img_dim;
+            RowNode* bright = new CombineNode(pass_input,tophat,COMBINE_ADD);
+            nodes.push_back(unique_ptr<RowNode>(bright));
+            last = new CombineNode(bright,blackhat,COMBINE_DIFF);
+            nodes.push_back(unique_ptr<RowNode>(last));
         }
-        
-        // Save the result
-        //img->pgmWrite(save_path_enhance + to_string(i) + "_enhance.pgm", pgm_desc + strel_name);
-        // Invert image
-        img->invertImage();
-        // Store into ROC array object
-        roc_curve->insertEnhanceImage(img);
-        //clear memory
-        delete img_bright[0];
-        delete img_bright;
-        
     }
 
+    if(invert){
+        last = new InvertNode(last);
+        nodes.push_back(unique_ptr<RowNode>(last));
+    }
+
+    return last;
+}
+
+/*enhance image with morphological operations streaming rows through a pipeline (no full size temporaries)
+    enhancetype = 1: image - tophat, enhancetype = 2: image + tophat - blackhat
+    n_passes enhancements are chained, optionally after gaussian smoothing and before inversion
+*/
+int** enhancePipeline(int** img, int rows, int cols, int** strel, int strel_radius, int enhancetype, int n_passes = 1, bool smooth = false, bool invert = false){
+    vector<unique_ptr<RowNode>> nodes;
+    SourceNode source(img,rows,cols);
+    RowNode* last = buildEnhancePipeline(nodes,&source,strel,strel_radius,enhancetype,n_passes,smooth,invert);
+    return runPipeline(last);
+}
+
+/*enhance image (1 pass) when the first erosion and dilation with strel are already computed
+    same result as enhancePipeline, only the second stage of opening and closing is streamed
+*/
+int** enhanceFromFirstStage(int** img, int** eroded, int** dilated, int rows, int cols, int** strel, int strel_radius, int enhancetype, bool invert = false){
+    vector<unique_ptr<RowNode>> nodes;
+    SourceNode input(img,rows,cols);
+    SourceNode open_erosion(eroded,rows,cols);
+    SourceNode close_dilation(dilated,rows,cols);
+
+    //tophat: image - opening
+    RowNode* opening = new MorphNode(&open_erosion,strel,strel_radius,MORPH_DILATION);
+    RowNode* tophat = new CombineNode(&input,opening,COMBINE_DIFF);
+    nodes.push_back(unique_ptr<RowNode>(opening));
+    nodes.push_back(unique_ptr<RowNode>(tophat));
+
+    RowNode* last;
+    if(enhancetype == 1){
+        //enhance original image by decreasing light (image - tophat)
+        last = new CombineNode(&input,tophat,COMBINE_DIFF);
+        nodes.push_back(unique_ptr<RowNode>(last));
+    }else{
+        //blackhat: closing - image
+        RowNode* closing = new MorphNode(&close_dilation,strel,strel_radius,MORPH_EROSION);
+        RowNode* blackhat = new CombineNode(closing,&input,COMBINE_DIFF);
+        nodes.push_back(unique_ptr<RowNode>(closing));
+        nodes.push_back(unique_ptr<RowNode>(blackhat));
+
+        //enhance original image by increasing contrast (image + tophat - blackhat)
+        RowNode* bright = new CombineNode(&input,tophat,COMBINE_ADD);
+        nodes.push_back(unique_ptr<RowNode>(bright));
+        last = new CombineNode(bright,blackhat,COMBINE_DIFF);
+        nodes.push_back(unique_ptr<RowNode>(last));
+    }
+
+    if(invert){
+        last = new InvertNode(last);
+        nodes.push_back(unique_ptr<RowNode>(last));
+    }
+    return runPipeline(last);
+}
+
+/*dataset selected on the command line and reference paths, key of the datasets cached in memory*/
+string datasetKey(){
+    return db_path + " " + to_string(db_size) + " " + to_string(db_init) + " " + mask_path + " " + gt_path;
+}
+
+/*training images read once and shared (read only) by every strel evaluation*/
+vector<Image*>& trainingImages(){
+    static vector<Image*> images;
+    static string loaded_key;
+
+    if(loaded_key != datasetKey()){
+        for(int i = 0; i < (int)images.size(); i++){
+            delete images[i];
+        }
+        images.clear();
+        for(int i = db_init; i < db_init + db_size; i++){
+            Image *img = new Image();
+            img->pgmRead(db_path + to_string(i) +"_training.pgm");
+            images.push_back(img);
+        }
+        loaded_key = datasetKey();
+    }
+    return images;
+}
+
+/*reduce matrix by factor over factor x factor blocks (remainder rows / columns are dropped)
+    mode 1: block mean, mode 2: block min, mode 3: block max
+*/
+int** downsampleMatrix(int** img, int rows, int cols, int factor, int mode){
+    int d_rows = rows/factor;
+    int d_cols = cols/factor;
+    int** reduced = createMatrix(d_rows,d_cols,0);
+
+    for(int i = 0; i < d_rows; i++){
+        for(int j = 0; j < d_cols; j++){
+            int sum = 0;
+            int min_v = img[i*factor][j*factor];
+            int max_v = min_v;
+            for(int k = 0; k < factor; k++){
+                for(int l = 0; l < factor; l++){
+                    int v = img[i*factor + k][j*factor + l];
+                    sum += v;
+                    min_v = min(min_v,v);
+                    max_v = max(max_v,v);
+                }
+            }
+            if(mode == 1)
+                reduced[i][j] = sum/(factor*factor);
+            else if(mode == 2)
+                reduced[i][j] = min_v;
+            else
+                reduced[i][j] = max_v;
+        }
+    }
+    return reduced;
+}
+
+/*training dataset downsampled by factor (images: mean, masks: every pixel inside, groundtruth: any vessel pixel)*/
+struct PyramidLevel{
+    int factor;
+    vector<Image*> images;
+    vector<Image*> masks;
+    vector<Image*> groundtruth;
+};
+
+/*pyramid level of the training dataset, built once per dataset and factor*/
+PyramidLevel* trainingPyramid(int factor){
+    static map<int,PyramidLevel*> levels;
+    static string loaded_key;
+
+    if(loaded_key != datasetKey()){
+        for(auto &level : levels){
+            for(int i = 0; i < (int)level.second->images.size(); i++){
+                delete level.second->images[i];
+                delete level.second->masks[i];
+                delete level.second->groundtruth[i];
+            }
+            delete level.second;
+        }
+        levels.clear();
+        loaded_key = datasetKey();
+    }
+    if(levels.count(factor))
+        return levels[factor];
+
+    PyramidLevel *level = new PyramidLevel();
+    level->factor = factor;
+    vector<Image*> &images = trainingImages();
+    for(int i = 0; i < (int)images.size(); i++){
+        Image mask_full, gt_full;
+        mask_full.pgmRead(mask_path + to_string(i + db_init) +"_training_mask.pgm");
+        gt_full.pgmRead(gt_path + to_string(i + db_init) +"_manual1.pgm");
+
+        int rows = images[i]->getRows();
+        int cols = images[i]->getCols();
+        Image *ptr = new Image();
+        ptr->setImage(downsampleMatrix(images[i]->getImage(),rows,cols,factor,1),rows/factor,cols/factor);
+        level->images.push_back(ptr);
+        ptr = new Image();
+        ptr->setImage(downsampleMatrix(mask_full.getImage(),rows,cols,factor,2),rows/factor,cols/factor);
+        level->masks.push_back(ptr);
+        ptr = new Image();
+        ptr->setImage(downsampleMatrix(gt_full.getImage(),rows,cols,factor,3),rows/factor,cols/factor);
+        level->groundtruth.push_back(ptr);
+    }
+    levels[factor] = level;
+    return level;
+}
+
+/*binary strel of radius scaled by factor, a cell is active when at least half of the cells it covers are active*/
+int** scaleStrel(int** strel, int radius, int factor, int &scaled_radius){
+    scaled_radius = max(1, radius/factor);
+    int len = scaled_radius*2+1;
+    int** scaled = createMatrix(len,len,0);
+
+    for(int i = 0; i < len; i++){
+        for(int j = 0; j < len; j++){
+            int active = 0, total = 0;
+            for(int k = 0; k < factor; k++){
+                for(int l = 0; l < factor; l++){
+                    int fi = radius + (i - scaled_radius)*factor + k - factor/2;
+                    int fj = radius + (j - scaled_radius)*factor + l - factor/2;
+                    if(fi < 0 || fj < 0 || fi > 2*radius || fj > 2*radius)
+                        continue;
+                    total++;
+                    if(strel[fi][fj] != 0)
+                        active++;
+                }
+            }
+            scaled[i][j] = (total > 0 && 2*active >= total) ? 1 : 0;
+        }
+    }
+    return scaled;
+}
+
+/*racing of candidates against the incumbent, image by image, on the mean per image AUC (the statistic local search accepts on)
+    a candidate is abandoned when the one sided t upper bound of its mean per image AUC difference with the incumbent is below 0,
+    alpha is split (Bonferroni) over the n_images - min_images rounds that can test it, so a candidate that is not worse
+    than the incumbent is abandoned with probability at most alpha over the whole race (normal per image differences)
+*/
+struct StrelRace{
+    vector<double> incumbent_auc;   //per image AUC of the incumbent
+    double incumbent_mean = 0;      //mean per image AUC of the incumbent
+    int min_images = 3;             //images evaluated before any candidate can be abandoned
+    double alpha = 0.01;            //probability of abandoning a candidate as good as the incumbent
+    int abandoned = 0;
+    int images_skipped = 0;
+};
+
+/*mean of the per image AUCs*/
+double meanAUC(const vector<double> &image_auc){
+    double sum = 0;
+    for(int i = 0; i < (int)image_auc.size(); i++){
+        sum += image_auc[i];
+    }
+    return image_auc.size() > 0 ? sum / image_auc.size() : 0;
+}
+
+/*evaluate a batch of candidate strels concurrently, returning the AUC of each one (-1 when abandoned by race)
+    every candidate x image pair is an independent task: enhance, invert and fold into rocs[k]
+    caches (one per training image, incumbent strel) give the first erosion and dilation from the changed taps only
+    with race, images are evaluated in rounds and losing candidates are dropped between rounds
+    image_auc (optional) receives the AUC of every candidate on every image
+    level (optional) evaluates on a downsampled dataset, strels and strel_param must be scaled to it
+*/
+vector<double> evaluateStrelBatch(const vector<ROC*> &rocs, const vector<int**> &strels, int strel_param[], int enhancetype, const vector<MorphDeltaCache*> *caches = nullptr, StrelRace *race = nullptr, vector<vector<double>> *image_auc = nullptr, PyramidLevel *level = nullptr, int n_threads = 0){
+    int n_candidates = strels.size();
+    vector<Image*> &images = (level != nullptr) ? level->images : trainingImages();
+    int n_images = images.size();
+
+    if(n_threads <= 0)
+        n_threads = hardwareThreads();
+    if(race != nullptr && (int)race->incumbent_auc.size() != n_images)
+        race = nullptr;
+
+    //masks and groundthruth are needed to fold each image
+    for(int k = 0; k < n_candidates; k++){
+        if(level != nullptr)
+            rocs[k]->setReferenceImages(level->masks,level->groundtruth);
+        rocs[k]->buildMaskArray(mask_path,db_size,db_init);
+        rocs[k]->buildGroundthruthArray(gt_path,db_size,db_init);
+        rocs[k]->clearEnhanceArray();
+    }
+
+    vector<char> alive(n_candidates,1);
+    vector<vector<double>> per_image(n_candidates,vector<double>(n_images,0));
+
+    //one lock per candidate while folding its counts
+    vector<mutex> roc_lock(n_candidates);
+    int first = 0;
+    while(first < n_images){
+        vector<int> alive_list;
+        for(int k = 0; k < n_candidates; k++){
+            if(alive[k])
+                alive_list.push_back(k);
+        }
+        if(alive_list.size() == 0)
+            break;
+
+        //without race every image goes in a single round, otherwise enough images to keep every thread busy
+        int round_images = n_images;
+        if(race != nullptr)
+            round_images = max(1, n_threads / (int)alive_list.size());
+        int last = min(n_images, first + round_images);
+        int n_round = last - first;
+
+        parallelTasks(alive_list.size()*n_round, [&](int task){
+            int k = alive_list[task / n_round];
+            int i = first + task % n_round;
+            Image *img = images[i];
+
+            //Apply morphological operations and invert image in a single streamed pass
+            int **img_enhanced;
+            if(caches == nullptr){
+                img_enhanced = enhancePipeline(img->getImage(),img->getRows(),img->getCols(),strels[k],strel_param[3],enhancetype,1,false,true);
+            }else{
+                int **eroded = createMatrix(img->getRows(),img->getCols(),0);
+                int **dilated = createMatrix(img->getRows(),img->getCols(),0);
+                (*caches)[i]->evaluate(strels[k],eroded,dilated);
+                img_enhanced = enhanceFromFirstStage(img->getImage(),eroded,dilated,img->getRows(),img->getCols(),strels[k],strel_param[3],enhancetype,true);
+                freeMatrix(eroded,img->getRows());
+                freeMatrix(dilated,img->getRows());
+            }
+
+            // Fold into ROC counts and discard image
+            ClassHistogram hist = rocs[k]->imageHistogram(img_enhanced,img->getRows(),img->getCols(),i);
+            per_image[k][i] = histogramAUC(hist);
+            {
+                lock_guard<mutex> guard(roc_lock[k]);
+                rocs[k]->addCounts(hist);
+            }
+            freeMatrix(img_enhanced,img->getRows());
+        }, n_threads);
+        first = last;
+
+        //drop candidates that cannot beat the incumbent with high confidence
+        if(race == nullptr || first >= n_images || first < race->min_images)
+            continue;
+        double t_bound = studentTQuantile(1 - race->alpha / (n_images - race->min_images), first - 1);
+        for(int a = 0; a < (int)alive_list.size(); a++){
+            int k = alive_list[a];
+            double mean = 0, var = 0;
+            for(int i = 0; i < first; i++){
+                mean += per_image[k][i] - race->incumbent_auc[i];
+            }
+            mean /= first;
+            for(int i = 0; i < first; i++){
+                double d = per_image[k][i] - race->incumbent_auc[i] - mean;
+                var += d*d;
+            }
+            var /= (first - 1);
+
+            if(mean + t_bound*sqrt(var/first) < 0){
+                alive[k] = 0;
+                race->abandoned++;
+                race->images_skipped += n_images - first;
+            }
+        }
+    }
+
+    vector<double> auc(n_candidates,-1);
+    for(int k = 0; k < n_candidates; k++){
+        if(!alive[k])
+            continue;
+        rocs[k]->calculateConfusionMatrix(true);
+        rocs[k]->calculateSensSpec();
+        rocs[k]->calculateAUC();
+        auc[k] = rocs[k]->getArea();
+    }
+    if(image_auc != nullptr)
+        *image_auc = per_image;
+    return auc;
+}
+
+/*evaluate strel with whole dataset, folding every enhanced image into the ROC counts as soon as it is produced*/
+void addStrelEvaluation(ROC* roc_curve, int** strel, string, int strel_param[], int enhancetype){
+    evaluateStrelBatch({roc_curve},{strel},strel_param,enhancetype);
 }
 
-/*enhance whole dataset with morphological kernels, saving images*/
-void enhanceDataset(int** strel, string strel_name, int strel_param[], int enhancetype, int ref_path){
+/*enhance whole dataset with morphological kernels, saving images
+    n_passes enhancements are chained in memory, optionally after gaussian smoothing
+*/
+void enhanceDataset(int** strel, string strel_name, int strel_param[], int enhancetype, int ref_path, int n_passes = 1, bool smooth = false){
     //image operation result
-    int **img_bright;
-    int **img_dim;
+    int **img_enhanced;
 
     //image object pointer
     Image *img;
@@ -2017,101 +2771,326 @@ void enhanceDataset(int** strel, string strel_name, int strel_param[], int enhan
             img->pgmRead(save_path_enhance + to_string(i) + "_enhance.pgm");
 
         //Apply morphological operations
-        if(enhancetype == 1){
-            //enhance original image by decreasing light (image - blackhat)
-            img_bright = img->morphOp("tophat",strel,strel_param[3]);
-            img->diffImage(img_bright);
-
-        }else{
-            //enhance original image by increasing contrast (image + tophat - blackhat)
-            img_bright = img->morphOp("tophat",strel,strel_param[3]);
-            img_dim = img->morphOp("blackhat",strel,strel_param[3]); 
-            img->addImage(img_bright);
-            img->diffImage(img_dim);
-            delete img_dim[0];
-            delete img_dim;
-        }
+        img_enhanced = enhancePipeline(img->getImage(),img->getRows(),img->getCols(),strel,strel_param[3],enhancetype,n_passes,smooth,false);
+        img->setImage(img_enhanced,img->getRows(),img->getCols());
         
         // Save the result
         img->pgmWrite(save_path_enhance + to_string(i) + "_enhance.pgm", pgm_desc + strel_name);
 
         //clear memory
-        delete img_bright[0];
-        delete img_bright;
-        
+        delete img;
     }
 
 }
 
 
 
-/*Local Search algorithm to improve strel response*/
-void localSearch(ROC* roc_best, int** strel,int strel_params[], int change_percent, int radius, int iterations){
+/*Local Search algorithm to improve strel response
+    candidates are generated and evaluated in batches of batch_size (0: one per hardware thread),
+    the best candidate of each batch replaces the incumbent when it improves the AUC
+    candidates are compared by their mean per image AUC, the statistic they are raced on
+    candidates already evaluated in this search (memo) are skipped unless their mean AUC beats the incumbent
+    candidates are raced image by image against the incumbent and abandoned once they are clearly worse
+    with pyramid screening, batches are scored on the downsampled dataset and only the best fraction at full resolution
+*/
+void localSearch(ROC*& roc_best, int**& strel,int strel_params[], int change_percent, int radius, int iterations, StrelSearch &search, int batch_size = 0){
 
-    //strel to impove
-    int** strel_aux;
+    if(batch_size <= 0)
+        batch_size = hardwareThreads();
 
-    //temporal roc pointer
-    ROC *roc_temp;
+    //screening needs enough candidates per batch to promote a fraction of them
+    PyramidLevel *level = nullptr;
+    int coarse_params[5] = {1,0,0,0,0};
+    if(search.pyramid_factor > 1){
+        level = trainingPyramid(search.pyramid_factor);
+        batch_size = max(batch_size, (int)ceil(1/search.promote_fraction));
+    }
 
-    //initial best ROC object
-    addStrelEvaluation(roc_best,strel,"binary descriptor",strel_params,2);
-    //confusion matrix
-    roc_best->calculateConfusionMatrix(true);
-    //sensitivity and specificity
-    roc_best->calculateSensSpec();
-    //AUC
-    roc_best->calculateAUC();
-    cout<<"Initial local AUC: "<<roc_best->getArea()<<endl;
+    //initial best ROC object, keeping its AUC per image to race candidates against it
+    StrelRace race;
+    vector<vector<double>> image_auc;
+    evaluateStrelBatch({roc_best},{strel},strel_params,2,nullptr,nullptr,&image_auc);
+    race.incumbent_auc = image_auc[0];
+    race.incumbent_mean = meanAUC(image_auc[0]);
+    search.memo[strelHash(strel,radius)] = race.incumbent_mean;
+    search.evaluations++;
+    cout<<"Initial local AUC: "<<roc_best->getArea()<<", mean per image: "<<race.incumbent_mean<<endl;
+
+    //first erosion / dilation of every training image with the incumbent, candidates only apply changed taps
+    vector<MorphDeltaCache*> caches;
+    if(MorphDeltaCache::binaryStrel(strel,radius)){
+        vector<Image*> &images = trainingImages();
+        caches.assign(images.size(),nullptr);
+        parallelTasks(images.size(),[&](int i){
+            caches[i] = new MorphDeltaCache(images[i]->getImage(),images[i]->getRows(),images[i]->getCols(),strel,radius);
+        });
+    }
 
-    //auxiliary ROC object
-    ROC *roc_aux = new ROC("binary_desc",strel_params);
-    //add training mask
-    roc_aux->buildMaskArray(mask_path,db_size,db_init);
-    //add training groundthruth
-    roc_aux->buildGroundthruthArray(gt_path,db_size,db_init);
+    //auxiliary ROC object per candidate in a batch (full and downsampled resolution)
+    vector<ROC*> roc_batch;
+    vector<ROC*> roc_coarse;
+    for(int k = 0; k < batch_size; k++){
+        roc_batch.push_back(new ROC("binary_desc",strel_params));
+        if(level != nullptr)
+            roc_coarse.push_back(new ROC("binary_desc",strel_params));
+    }
 
-    for(int i = 0; i< iterations; i++){
-        //perturbate strel at "change percent" of pixels
-        strel_aux = randomBinaryDescriptor(strel,change_percent,radius);
+    for(int i = 0; i < iterations; i += batch_size){
+        int n_batch = min(batch_size, iterations - i);
 
-        //evaluate strel
-        addStrelEvaluation(roc_aux,strel_aux,"binary descriptor",strel_params,2);
-        roc_aux->calculateConfusionMatrix(true);
-        roc_aux->calculateSensSpec();
-        roc_aux->calculateAUC();
-        cout<<"local search AUC: "<<roc_aux->getArea()<<endl;
+        //perturbate strel at "change percent" of pixels, skipping repeated strels
+        vector<int**> candidates;
+        vector<uint64_t> hashes;
+        for(int k = 0; k < n_batch; k++){
+            int** candidate = randomBinaryDescriptor(strel,change_percent,radius,search.rng);
+            uint64_t hash = strelHash(candidate,radius);
 
-        if(roc_aux->getArea() > roc_best->getArea()){
-            
-            roc_temp = roc_best;
-            roc_best = roc_aux;
-            roc_aux = roc_temp;
+            bool repeated = find(hashes.begin(),hashes.end(),hash) != hashes.end();
+            auto seen = search.memo.find(hash);
+            if(seen != search.memo.end() && seen->second <= race.incumbent_mean)
+                repeated = true;
 
-            delete strel[0];
-            delete strel;
-            strel = strel_aux;
-        }else{
-  
-            delete strel_aux[0];
-            delete strel_aux;
+            if(repeated){
+                search.repeats++;
+                freeMatrix(candidate,2*radius+1);
+                continue;
+            }
+            candidates.push_back(candidate);
+            hashes.push_back(hash);
+        }
+        if(candidates.size() == 0)
+            continue;
+
+        //screen at coarse resolution, promoting the best fraction (every candidate in calibration batches)
+        vector<int> promoted;
+        vector<double> coarse_auc;
+        bool calibration = false;
+        for(int k = 0; k < (int)candidates.size(); k++){
+            promoted.push_back(k);
+        }
+        if(level != nullptr){
+            calibration = (search.batches % search.calibration_every) == 0;
+            search.batches++;
+
+            vector<int**> scaled;
+            for(int k = 0; k < (int)candidates.size(); k++){
+                scaled.push_back(scaleStrel(candidates[k],radius,search.pyramid_factor,coarse_params[3]));
+            }
+            vector<ROC*> rocs(roc_coarse.begin(), roc_coarse.begin() + candidates.size());
+            vector<vector<double>> coarse_image_auc;
+            evaluateStrelBatch(rocs,scaled,coarse_params,2,nullptr,nullptr,&coarse_image_auc,level);
+            for(int k = 0; k < (int)scaled.size(); k++){
+                coarse_auc.push_back(meanAUC(coarse_image_auc[k]));
+            }
+            search.coarse_evaluations += candidates.size();
+            for(int k = 0; k < (int)scaled.size(); k++){
+                freeMatrix(scaled[k],2*coarse_params[3]+1);
+            }
+
+            if(!calibration){
+                sort(promoted.begin(), promoted.end(), [&coarse_auc](int a, int b){
+                    return coarse_auc[a] > coarse_auc[b];
+                });
+                promoted.resize(max(1, (int)ceil(search.promote_fraction*candidates.size())));
+            }
+        }
+
+        //evaluate promoted strels at full resolution (calibration batches are not raced so every AUC is complete)
+        vector<int**> fine_candidates;
+        for(int p = 0; p < (int)promoted.size(); p++){
+            fine_candidates.push_back(candidates[promoted[p]]);
+        }
+        vector<ROC*> rocs(roc_batch.begin(), roc_batch.begin() + fine_candidates.size());
+        vector<double> auc = evaluateStrelBatch(rocs,fine_candidates,strel_params,2,caches.size() > 0 ? &caches : nullptr,calibration ? nullptr : &race,&image_auc);
+
+        int best = 0;
+        vector<double> mean_auc(promoted.size(),-1);
+        for(int p = 0; p < (int)promoted.size(); p++){
+            search.evaluations++;
+            //abandoned candidates have no AUC over the whole dataset
+            if(auc[p] < 0){
+                cout<<"local search AUC: abandoned"<<endl;
+                continue;
+            }
+            mean_auc[p] = meanAUC(image_auc[p]);
+            search.memo[hashes[promoted[p]]] = mean_auc[p];
+            cout<<"local search AUC: "<<auc[p]<<", mean per image: "<<mean_auc[p]<<endl;
+            if(calibration){
+                search.coarse_scores.push_back(coarse_auc[promoted[p]]);
+                search.fine_scores.push_back(mean_auc[p]);
+            }
+            if(mean_auc[p] > mean_auc[best])
+                best = p;
+        }
+
+        if(mean_auc[best] > race.incumbent_mean){
+            swap(roc_best, roc_batch[best]);
+
+            freeMatrix(strel,2*radius+1);
+            strel = candidates[promoted[best]];
+            candidates[promoted[best]] = nullptr;
+            race.incumbent_auc = image_auc[best];
+            race.incumbent_mean = mean_auc[best];
+
+            parallelTasks(caches.size(),[&](int i){
+                caches[i]->rebase(strel);
+            });
+        }
+
+        for(int k = 0; k < (int)candidates.size(); k++){
+            freeMatrix(candidates[k],2*radius+1);
         }
-        roc_aux->clearEnhanceArray();
     }
 
+    search.abandoned += race.abandoned;
+    search.images_skipped += race.images_skipped;
 
     //clear memory
-    delete roc_aux;
+    for(int k = 0; k < batch_size; k++){
+        delete roc_batch[k];
+    }
+    for(int k = 0; k < (int)roc_coarse.size(); k++){
+        delete roc_coarse[k];
+    }
+    for(int i = 0; i < (int)caches.size(); i++){
+        delete caches[i];
+    }
+}
+
+
+/*write iterated local search state after next_iteration - 1 restarts: incumbent strel and AUC, generator, counters and memo
+    the file is written next to its final name and renamed, so a killed run leaves the previous checkpoint intact
+*/
+void saveSearchCheckpoint(string file_name, string key, int next_iteration, int** strel, int radius, double auc, StrelSearch &search){
+    string tmp_name = file_name + ".tmp";
+    ofstream file(tmp_name);
+    if(!file.is_open()){
+        cout<<"ERROR: cannot write search checkpoint "<<file_name<<endl;
+        return;
+    }
+
+    file << key << endl;
+    file << setprecision(17);
+    file << next_iteration << " " << search.seed << " " << auc << endl;
+    file << search.rng << endl;
+    file << search.evaluations << " " << search.repeats << " " << search.abandoned << " " << search.images_skipped << " ";
+    file << search.coarse_evaluations << " " << search.batches << endl;
+    for(int i = 0; i < 2*radius+1; i++){
+        for(int j = 0; j < 2*radius+1; j++){
+            file << strel[i][j] << " ";
+        }
+        file << endl;
+    }
+    file << search.coarse_scores.size() << endl;
+    for(int k = 0; k < (int)search.coarse_scores.size(); k++){
+        file << search.coarse_scores[k] << " " << search.fine_scores[k] << endl;
+    }
+    file << search.memo.size() << endl;
+    for(auto &entry : search.memo){
+        file << entry.first << " " << entry.second << endl;
+    }
+    file.close();
+
+    if(file.fail() || rename(tmp_name.c_str(), file_name.c_str()) != 0)
+        cout<<"ERROR: cannot write search checkpoint "<<file_name<<endl;
 }
 
+/*read iterated local search state, returning the next restart (-1 if missing or written by a search with other parameters)
+    strel (radius) receives the incumbent and auc its AUC
+*/
+int loadSearchCheckpoint(string file_name, string key, int** strel, int radius, double &auc, StrelSearch &search){
+    ifstream file(file_name);
+    if(!file.is_open())
+        return -1;
+
+    string file_key;
+    getline(file, file_key);
+    if(file_key != key)
+        return -1;
+
+    //read into a copy, so a truncated file leaves search untouched
+    StrelSearch state(1);
+    int next_iteration = -1;
+    file >> next_iteration >> state.seed >> auc;
+    file >> state.rng;
+    file >> state.evaluations >> state.repeats >> state.abandoned >> state.images_skipped;
+    file >> state.coarse_evaluations >> state.batches;
+
+    int len = 2*radius+1;
+    int** incumbent = createMatrix(len, len, 0);
+    for(int i = 0; i < len; i++){
+        for(int j = 0; j < len; j++){
+            file >> incumbent[i][j];
+        }
+    }
+
+    int n_scores = 0;
+    file >> n_scores;
+    for(int k = 0; k < n_scores && file.good(); k++){
+        double coarse, fine;
+        file >> coarse >> fine;
+        state.coarse_scores.push_back(coarse);
+        state.fine_scores.push_back(fine);
+    }
+
+    int n_memo = 0;
+    file >> n_memo;
+    for(int k = 0; k < n_memo && file.good(); k++){
+        uint64_t hash;
+        double value;
+        file >> hash >> value;
+        state.memo[hash] = value;
+    }
 
-/*Apply iterated local search to improve initial strel response*/
-ROC *iteratedLocalSearch(int** init_strel, int radius, int iterations){
+    if(file.fail() || next_iteration < 0){
+        freeMatrix(incumbent, len);
+        return -1;
+    }
+
+    for(int i = 0; i < len; i++){
+        for(int j = 0; j < len; j++){
+            strel[i][j] = incumbent[i][j];
+        }
+    }
+    freeMatrix(incumbent, len);
+
+    state.pyramid_factor = search.pyramid_factor;
+    state.promote_fraction = search.promote_fraction;
+    state.calibration_every = search.calibration_every;
+    search = state;
+    return next_iteration;
+}
+
+/*Apply iterated local search to improve initial strel response
+    seed = 0 takes a random seed, the seed is printed so the run can be repeated
+    pyramid_factor (2 or 4) screens local search candidates on the downsampled dataset
+    the search state is checkpointed after every restart and resumed from checkpoint_file when it matches this search,
+    the checkpoint is removed once the search finishes ("" disables checkpoints)
+    init_strel is replaced with the best strel found
+*/
+ROC *iteratedLocalSearch(int**& init_strel, int radius, int iterations, unsigned int seed = 0, int pyramid_factor = 0, string checkpoint_file = "ils_checkpoint.txt"){
+
+    //generator and memo of evaluated strels for the whole search
+    StrelSearch search(seed);
+    search.pyramid_factor = pyramid_factor;
 
     //strel params
     int** strel_aux;
     int strel_param[5] = {1,0,0,radius,0};
 
+    //checkpoints only resume searches with the same parameters, requested seed, dataset and reference images
+    string checkpoint_key = "ils radius " + to_string(radius) + " iterations " + to_string(iterations) + " pyramid " + to_string(pyramid_factor);
+    if(seed != 0)
+        checkpoint_key += " seed " + to_string(seed);
+    checkpoint_key += " dataset " + datasetKey();
+    int first_iteration = 0;
+    double checkpoint_auc = 0;
+    if(checkpoint_file.size() != 0)
+        first_iteration = max(0, loadSearchCheckpoint(checkpoint_file,checkpoint_key,init_strel,radius,checkpoint_auc,search));
+    if(first_iteration > 0)
+        cout<<"Resuming search from "<<checkpoint_file<<" at restart "<<first_iteration<<" of "<<iterations<<endl;
+    cout<<"Search seed: "<<search.seed<<endl;
+
     //temporal roc pointer
     ROC *roc_temp;
 
@@ -2128,6 +3107,12 @@ ROC *iteratedLocalSearch(int** init_strel, int radius, int iterations){
     roc_best->calculateSensSpec();
     //AUC
     roc_best->calculateAUC();
+    //the memo holds mean per image AUCs, local searches add their own starting strels
+    if(first_iteration == 0){
+        search.evaluations++;
+    }else if(roc_best->getArea() != checkpoint_auc){
+        cout<<"WARNING: incumbent AUC "<<roc_best->getArea()<<" differs from checkpoint AUC "<<checkpoint_auc<<endl;
+    }
     cout<<"Initial AUC: "<<roc_best->getArea()<<endl;
 
     //auxiliary ROC object
@@ -2137,11 +3122,11 @@ ROC *iteratedLocalSearch(int** init_strel, int radius, int iterations){
     //add training groundthruth
     roc_aux->buildGroundthruthArray(gt_path,db_size,db_init);
 
-    for(int i = 0; i< iterations; i++){
+    for(int i = first_iteration; i< iterations; i++){
         //perturbate strel at 75% of pixels
-        strel_aux = randomBinaryDescriptor(init_strel,75,radius);
+        strel_aux = randomBinaryDescriptor(init_strel,75,radius,search.rng);
         //local search to improve strel respoonse
-        localSearch(roc_aux,strel_aux,strel_param,15,radius,iterations);
+        localSearch(roc_aux,strel_aux,strel_param,15,radius,iterations,search);
         cout<<"best local search AUC: "<<roc_best->getArea()<<endl;
         //evaluate strel
         if(roc_aux->getArea() > roc_best->getArea()){
@@ -2149,20 +3134,411 @@ ROC *iteratedLocalSearch(int** init_strel, int radius, int iterations){
             roc_best = roc_aux;
             roc_aux = roc_temp;
 
-            delete init_strel[0];
-            delete init_strel;
-            init_strel = strel_aux;
-        }else{
-            delete strel_aux[0];
-            delete strel_aux;
+            freeMatrix(init_strel,2*radius+1);
+            init_strel = strel_aux;
+        }else{
+            freeMatrix(strel_aux,2*radius+1);
+        }
+        roc_aux->clearEnhanceArray();
+
+        if(checkpoint_file.size() != 0)
+            saveSearchCheckpoint(checkpoint_file,checkpoint_key,i+1,init_strel,radius,roc_best->getArea(),search);
+    }
+    if(checkpoint_file.size() != 0)
+        remove(checkpoint_file.c_str());
+
+    cout<<"Strel evaluations: "<<search.evaluations<<", repeated strels skipped: "<<search.repeats<<endl;
+    cout<<"Candidates abandoned by racing: "<<search.abandoned<<", image evaluations saved: "<<search.images_skipped<<endl;
+    if(search.pyramid_factor > 1){
+        cout<<"Coarse (1/"<<search.pyramid_factor<<") evaluations: "<<search.coarse_evaluations;
+        cout<<", coarse vs full resolution rank correlation (Spearman, "<<search.fine_scores.size()<<" calibration strels): ";
+        cout<<spearmanCorrelation(search.coarse_scores,search.fine_scores)<<endl;
+    }
+
+    //clear memory
+    delete roc_aux;
+    return roc_best;
+}
+
+
+/*optimizers selectable for binary descriptor search*/
+const int OPTIMIZER_ILS = 1;            //iterated local search (hill climber)
+const int OPTIMIZER_GENETIC = 2;        //evolutionary, (mu + lambda) with uniform crossover
+const int OPTIMIZER_ANNEALING = 3;      //parallel simulated annealing chains
+
+/*evaluation budget and convergence criteria of a population optimizer*/
+struct OptimizerBudget{
+    int max_evaluations = 200;          //full resolution strel evaluations (memo hits are free)
+    int max_generations = 50;
+    int stall_generations = 8;          //stop after this many generations without improving the best AUC
+    double min_improvement = 1e-4;      //smaller gains count as stalled
+};
+
+/*population based search over binary descriptors
+    every generation is evaluated as a single parallel batch, so the whole population is in flight at once
+    derived optimizers only create the initial population, propose candidates and select survivors
+*/
+class StrelOptimizer{
+    protected:
+        int radius;
+        int strel_param[5];
+        StrelSearch &search;
+        OptimizerBudget budget;
+        ROC* roc_best;
+        int** best_strel;
+        vector<ROC*> roc_pool;
+
+        //convergence trace, one entry per generation
+        vector<double> best_history;
+        vector<double> mean_history;
+        vector<int> evaluation_history;
+
+        /*evaluate candidates, reading repeated strels from the memo (AUC of each candidate)*/
+        vector<double> evaluatePopulation(const vector<int**> &candidates){
+            int len = 2*radius+1;
+            vector<double> auc(candidates.size(),-1);
+            vector<int> pending;
+            vector<uint64_t> hashes(candidates.size());
+            for(int k = 0; k < (int)candidates.size(); k++){
+                hashes[k] = strelHash(candidates[k],radius);
+                auto seen = search.memo.find(hashes[k]);
+                if(seen != search.memo.end()){
+                    auc[k] = seen->second;
+                    search.repeats++;
+                }else{
+                    pending.push_back(k);
+                }
+            }
+
+            //new strels within the remaining budget
+            int remaining = budget.max_evaluations - search.evaluations;
+            if((int)pending.size() > remaining)
+                pending.resize(max(0,remaining));
+            while(roc_pool.size() < pending.size()){
+                roc_pool.push_back(new ROC("binary_desc",strel_param));
+            }
+
+            vector<ROC*> rocs(roc_pool.begin(), roc_pool.begin() + pending.size());
+            vector<int**> strels;
+            for(int p = 0; p < (int)pending.size(); p++){
+                strels.push_back(candidates[pending[p]]);
+            }
+            vector<double> batch_auc = evaluateStrelBatch(rocs,strels,strel_param,2);
+
+            for(int p = 0; p < (int)pending.size(); p++){
+                int k = pending[p];
+                auc[k] = batch_auc[p];
+                search.memo[hashes[k]] = auc[k];
+                search.evaluations++;
+
+                //keep ROC object and strel of the best strel found so far
+                if(roc_best == nullptr || auc[k] > roc_best->getArea()){
+                    swap(roc_best, roc_pool[p]);
+                    if(roc_pool[p] == nullptr)
+                        roc_pool[p] = new ROC("binary_desc",strel_param);
+                    freeMatrix(best_strel,len);
+                    best_strel = copyImage(candidates[k],len,len);
+                }
+            }
+            return auc;
+        }
+
+        /*first generation around the initial strel*/
+        virtual vector<int**> initialPopulation(int** init_strel) = 0;
+
+        /*candidates for next generation*/
+        virtual vector<int**> propose() = 0;
+
+        /*update population with evaluated candidates (takes ownership of candidates)*/
+        virtual void select(vector<int**> &candidates, const vector<double> &auc) = 0;
+
+        /*AUC of current population (convergence trace)*/
+        virtual double populationMean() = 0;
+
+    public:
+        StrelOptimizer(int strel_radius, StrelSearch &strel_search, OptimizerBudget optimizer_budget) : search(strel_search){
+            radius = strel_radius;
+            int params[5] = {1,0,0,radius,0};
+            copy(params, params + 5, strel_param);
+            budget = optimizer_budget;
+            roc_best = nullptr;
+            best_strel = nullptr;
+        }
+
+        virtual ~StrelOptimizer(){
+            for(int k = 0; k < (int)roc_pool.size(); k++){
+                delete roc_pool[k];
+            }
+            freeMatrix(best_strel,2*radius+1);
+        }
+
+        virtual string name() = 0;
+
+        /*search from strel until the budget is spent or the best AUC stalls
+            strel is replaced with the best strel found, returns its ROC object (owned by the caller)
+            or nullptr when no candidate could be evaluated (strel unchanged)
+        */
+        ROC* run(int**& strel){
+            vector<int**> candidates = initialPopulation(strel);
+            vector<double> auc = evaluatePopulation(candidates);
+            select(candidates, auc);
+            if(roc_best == nullptr){
+                cout<<name()<<" stopped: no candidate evaluated (evaluation budget "<<budget.max_evaluations<<", used "<<search.evaluations<<")"<<endl;
+                return nullptr;
+            }
+
+            double stalled_best = roc_best->getArea();
+            int stalled = 0;
+            string reason = "generation limit";
+            for(int g = 0; ; g++){
+                best_history.push_back(roc_best->getArea());
+                mean_history.push_back(populationMean());
+                evaluation_history.push_back(search.evaluations);
+                cout<<name()<<" generation "<<g<<": evaluations "<<search.evaluations<<", best AUC "<<roc_best->getArea()<<", population mean AUC "<<mean_history.back()<<endl;
+
+                if(roc_best->getArea() > stalled_best + budget.min_improvement){
+                    stalled_best = roc_best->getArea();
+                    stalled = 0;
+                }else if(g > 0){
+                    stalled++;
+                }
+
+                if(search.evaluations >= budget.max_evaluations){
+                    reason = "evaluation budget";
+                    break;
+                }
+                if(stalled >= budget.stall_generations){
+                    reason = "converged (no improvement in " + to_string(stalled) + " generations)";
+                    break;
+                }
+                if(g + 1 >= budget.max_generations)
+                    break;
+
+                candidates = propose();
+                auc = evaluatePopulation(candidates);
+                select(candidates, auc);
+            }
+            cout<<name()<<" stopped: "<<reason<<endl;
+
+            freeMatrix(strel,2*radius+1);
+            strel = copyImage(best_strel,2*radius+1,2*radius+1);
+            ROC* result = roc_best;
+            roc_best = nullptr;
+            return result;
+        }
+
+        vector<double> bestHistory(){
+            return best_history;
+        }
+
+        vector<double> meanHistory(){
+            return mean_history;
+        }
+
+        vector<int> evaluationHistory(){
+            return evaluation_history;
+        }
+};
+
+/*(mu + lambda) evolutionary search: tournament parents, uniform crossover, random descriptor mutation
+    parents and offspring compete for the next population, so the best strel is never lost
+*/
+class GeneticStrelOptimizer : public StrelOptimizer{
+    private:
+        int population_size;
+        int mutation_percent;
+        vector<int**> population;
+        vector<double> fitness;
+
+        /*best of two random members*/
+        int tournament(){
+            uniform_int_distribution<int> member(0, population.size()-1);
+            int a = member(search.rng);
+            int b = member(search.rng);
+            return fitness[a] >= fitness[b] ? a : b;
+        }
+
+    protected:
+        vector<int**> initialPopulation(int** init_strel){
+            vector<int**> candidates;
+            candidates.push_back(copyImage(init_strel,2*radius+1,2*radius+1));
+            while((int)candidates.size() < population_size){
+                candidates.push_back(randomBinaryDescriptor(init_strel,75,radius,search.rng));
+            }
+            return candidates;
+        }
+
+        vector<int**> propose(){
+            int len = 2*radius+1;
+            bernoulli_distribution coin(0.5);
+            vector<int**> offspring;
+            for(int k = 0; k < population_size; k++){
+                int** a = population[tournament()];
+                int** b = population[tournament()];
+                int** child = createMatrix(len,len,0);
+                for(int i = 0; i < len; i++){
+                    for(int j = 0; j < len; j++){
+                        child[i][j] = coin(search.rng) ? a[i][j] : b[i][j];
+                    }
+                }
+                offspring.push_back(randomBinaryDescriptor(child,mutation_percent,radius,search.rng));
+                freeMatrix(child,len);
+            }
+            return offspring;
+        }
+
+        void select(vector<int**> &candidates, const vector<double> &auc){
+            //unevaluated candidates (budget spent) are dropped
+            vector<pair<double,int**>> pool;
+            for(int k = 0; k < (int)population.size(); k++){
+                pool.push_back({fitness[k], population[k]});
+            }
+            for(int k = 0; k < (int)candidates.size(); k++){
+                if(auc[k] >= 0)
+                    pool.push_back({auc[k], candidates[k]});
+                else
+                    freeMatrix(candidates[k],2*radius+1);
+            }
+            stable_sort(pool.begin(), pool.end(), [](const pair<double,int**> &a, const pair<double,int**> &b){
+                return a.first > b.first;
+            });
+
+            population.clear();
+            fitness.clear();
+            for(int k = 0; k < (int)pool.size(); k++){
+                if(k < population_size){
+                    fitness.push_back(pool[k].first);
+                    population.push_back(pool[k].second);
+                }else{
+                    freeMatrix(pool[k].second,2*radius+1);
+                }
+            }
+        }
+
+        double populationMean(){
+            double sum = 0;
+            for(int k = 0; k < (int)fitness.size(); k++){
+                sum += fitness[k];
+            }
+            return fitness.size() > 0 ? sum / fitness.size() : 0;
+        }
+
+    public:
+        /*population_size = 0 takes two candidates per hardware thread (at least 8)*/
+        GeneticStrelOptimizer(int strel_radius, StrelSearch &strel_search, OptimizerBudget optimizer_budget, int n_population = 0, int mutation = 5)
+            : StrelOptimizer(strel_radius, strel_search, optimizer_budget){
+            population_size = (n_population > 0) ? n_population : max(8, 2*hardwareThreads());
+            mutation_percent = mutation;
+        }
+
+        ~GeneticStrelOptimizer(){
+            for(int k = 0; k < (int)population.size(); k++){
+                freeMatrix(population[k],2*radius+1);
+            }
+        }
+
+        string name(){
+            return "genetic";
+        }
+};
+
+/*independent simulated annealing chains advanced in lockstep, one proposal per chain and generation
+    worse proposals are accepted with probability exp(delta AUC / temperature), temperature decays geometrically
+*/
+class AnnealingStrelOptimizer : public StrelOptimizer{
+    private:
+        int n_chains;
+        int change_percent;
+        double temperature;
+        double cooling;
+        vector<int**> chains;
+        vector<double> energy;          //AUC of the current strel of each chain
+
+    protected:
+        vector<int**> initialPopulation(int** init_strel){
+            vector<int**> candidates;
+            candidates.push_back(copyImage(init_strel,2*radius+1,2*radius+1));
+            while((int)candidates.size() < n_chains){
+                candidates.push_back(randomBinaryDescriptor(init_strel,75,radius,search.rng));
+            }
+            return candidates;
+        }
+
+        vector<int**> propose(){
+            vector<int**> proposals;
+            for(int c = 0; c < (int)chains.size(); c++){
+                proposals.push_back(randomBinaryDescriptor(chains[c],change_percent,radius,search.rng));
+            }
+            return proposals;
+        }
+
+        void select(vector<int**> &candidates, const vector<double> &auc){
+            //first generation starts every chain
+            if(chains.size() == 0){
+                for(int k = 0; k < (int)candidates.size(); k++){
+                    if(auc[k] >= 0){
+                        chains.push_back(candidates[k]);
+                        energy.push_back(auc[k]);
+                    }else{
+                        freeMatrix(candidates[k],2*radius+1);
+                    }
+                }
+                return;
+            }
+
+            uniform_real_distribution<double> uniform(0.0,1.0);
+            for(int c = 0; c < (int)candidates.size(); c++){
+                double delta = auc[c] - energy[c];
+                bool accept = auc[c] >= 0 && (delta >= 0 || uniform(search.rng) < exp(delta / temperature));
+                if(accept){
+                    freeMatrix(chains[c],2*radius+1);
+                    chains[c] = candidates[c];
+                    energy[c] = auc[c];
+                }else{
+                    freeMatrix(candidates[c],2*radius+1);
+                }
+            }
+            temperature *= cooling;
+        }
+
+        double populationMean(){
+            double sum = 0;
+            for(int c = 0; c < (int)energy.size(); c++){
+                sum += energy[c];
+            }
+            return energy.size() > 0 ? sum / energy.size() : 0;
+        }
+
+    public:
+        /*n_chains = 0 takes one chain per hardware thread (at least 4)
+            initial temperature is in AUC units: t0 = 0.005 accepts a 0.005 loss with probability 1/e
+        */
+        AnnealingStrelOptimizer(int strel_radius, StrelSearch &strel_search, OptimizerBudget optimizer_budget, int chains_n = 0, int change = 15, double t0 = 0.005, double cooling_rate = 0.85)
+            : StrelOptimizer(strel_radius, strel_search, optimizer_budget){
+            n_chains = (chains_n > 0) ? chains_n : max(4, hardwareThreads());
+            change_percent = change;
+            temperature = t0;
+            cooling = cooling_rate;
+        }
+
+        ~AnnealingStrelOptimizer(){
+            for(int c = 0; c < (int)chains.size(); c++){
+                freeMatrix(chains[c],2*radius+1);
+            }
         }
-        roc_aux->clearEnhanceArray();
-        
-    }
 
-    //clear memory
-    delete roc_aux;
-    return roc_best;
+        string name(){
+            return "annealing";
+        }
+};
+
+/*create a population optimizer (OPTIMIZER_GENETIC, OPTIMIZER_ANNEALING), nullptr for other types*/
+StrelOptimizer* createStrelOptimizer(int optimizer, int radius, StrelSearch &search, OptimizerBudget budget){
+    if(optimizer == OPTIMIZER_GENETIC)
+        return new GeneticStrelOptimizer(radius, search, budget);
+    if(optimizer == OPTIMIZER_ANNEALING)
+        return new AnnealingStrelOptimizer(radius, search, budget);
+    return nullptr;
 }
 
 
@@ -2182,7 +3558,7 @@ ROC *strelType(string strel_name, int strel_param[], int enhancetype){
         roc_curve = iteratedLocalSearch(strel,strel_param[3],10);
         //print best strel
         Image *img = new Image();
-        img->setImage(strel, strel_param[3]*2+1,strel_param[3]*2+1);
+        img->setImage(strel, strel_param[3]*2+1,strel_param[3]*2+1,true,true);
         img->pgmWrite("best_strel.pgm","best strel from ILS algorithm");
         delete img;
         
@@ -2193,58 +3569,41 @@ ROC *strelType(string strel_name, int strel_param[], int enhancetype){
     return roc_curve;
 }
 
-/*Test different parameters for image enhancement, returning the best set of strel and size*/
-void testEnhanceParams(string* strel_names, int* strel_params, int* strel_radii, int n_tests, int enhancetype){
-
-    //array of ROC evaluation per strel combination
-    ROC* roc_array[n_tests];
-
-    //evalute every strel name and size combination
-    cout << setw(20) << left << "|Strel" << setw(10) << left << "|Radio" << setw(10) << "|AUC" << endl;
-
-    for(int i = 0; i < 2; i++){
-        for(int j = 0; j < 4; j++){
-            strel_params[1] = strel_radii[j]*2 + 1;
-            strel_params[2] = strel_radii[j]*2 + 1;
-            strel_params[3] = strel_radii[j];
-            //enhance images
-            roc_array[j + 6*i] = strelType(strel_names[i],strel_params,enhancetype);
-            //add training mask
-            roc_array[j + 6*i]->buildMaskArray(mask_path,db_size,db_init);
-            //add training groundthruth
-            roc_array[j + 6*i]->buildGroundthruthArray(gt_path,db_size,db_init);
-            //confusion matrix
-            roc_array[j + 6*i]->calculateConfusionMatrix(true);
-            //sensitivity and specificity
-            roc_array[j + 6*i]->calculateSensSpec();
-            //AUC
-            roc_array[j + 6*i]->calculateAUC();
-            roc_array[j + 6*i]->printROCData();
-        }
-    }
-}
-
 /*Enhance images applying traditional symetric structuring element*/
-void enhanceSymetricStrel(string strel_name, int strel_params[], int enhancetype,int ref_path){
+void enhanceSymetricStrel(string strel_name, int strel_params[], int enhancetype,int ref_path, int n_passes = 1, bool smooth = false){
     
     int** strel = createStrel(strel_name,strel_params[0],strel_params[1],strel_params[2],strel_params[3],strel_params[4]);
-    enhanceDataset(strel,strel_name,strel_params,enhancetype,ref_path);
+    enhanceDataset(strel,strel_name,strel_params,enhancetype,ref_path,n_passes,smooth);
 
     delete strel[0];
     delete strel;
 }
 
-/*Enhance images applying the best binary descriptor from ILS algorithm*/
-void enhanceBinaryDescriptor(int* strel_params){
+/*Enhance images applying the best binary descriptor from a strel search
+    optimizer: OPTIMIZER_ILS, OPTIMIZER_GENETIC or OPTIMIZER_ANNEALING (population optimizers use the default budget)
+    pyramid_factor (2 or 4) screens ILS candidates on the downsampled dataset
+*/
+void enhanceBinaryDescriptor(int* strel_params, int optimizer = OPTIMIZER_ILS, int pyramid_factor = 0){
     strel_params[3] = 8;
     int** strel = createStrel("diamond",strel_params[0],strel_params[1],strel_params[2],strel_params[3],strel_params[4]);
-    ROC* roc_curve = iteratedLocalSearch(strel,strel_params[3],5);
-    roc_curve->printROCData();
+    ROC* roc_curve;
+    if(optimizer == OPTIMIZER_ILS){
+        roc_curve = iteratedLocalSearch(strel,strel_params[3],5,0,pyramid_factor);
+    }else{
+        StrelSearch search;
+        cout<<"Search seed: "<<search.seed<<endl;
+        StrelOptimizer* strel_optimizer = createStrelOptimizer(optimizer,strel_params[3],search,OptimizerBudget());
+        roc_curve = strel_optimizer->run(strel);
+        cout<<"Strel evaluations: "<<search.evaluations<<", repeated strels skipped: "<<search.repeats<<endl;
+        delete strel_optimizer;
+    }
+    if(roc_curve != nullptr)
+        roc_curve->printROCData();
 
     //print best strel
     Image *img = new Image();
-    img->setImage(strel, strel_params[3]*2+1,strel_params[3]*2+1);
-    img->pgmWrite("best_strel.pgm","best strel from ILS algorithm");
+    img->setImage(strel, strel_params[3]*2+1,strel_params[3]*2+1,true,true);
+    img->pgmWrite("best_strel.pgm","best strel from binary descriptor search");
 
     delete img;
     delete roc_curve;
@@ -2252,32 +3611,135 @@ void enhanceBinaryDescriptor(int* strel_params){
     delete strel;
 }
 
-/*enhance images with matching gaussian filter*/
-void gaussianMatchingFilter(int* gmf_params, int ref_path){
+/*rotated gaussian matching filter kernels and their compiled filter bank*/
+struct GMFKernelBank{
+    int k_rows;
+    int k_cols;
+    vector<int**> rotated;
+    FilterBank bank;
+};
 
-    //create gaussian matching filter
-    int extraL = gmf_params[1]/2;
-    int extraT = gmf_params[2]/2;
-    int** gmf_kernel = createGMFkernel(gmf_params,extraL,extraT);
-    int** gmf_rotated[12];
-    //create image matrix
-    int** img_matrix = createMatrix(584,565,0);
-    int** img_aux;
+//kernel banks built during this process, keyed by sigma, L, T, angle step and padding
+map<string, GMFKernelBank*> gmf_bank_cache;
 
-    Image *img;
+/*write kernel bank into a text file*/
+void saveGMFKernelBank(string file_name, string key, GMFKernelBank* gmf_bank){
+    ofstream file(file_name);
+    if(!file.is_open()){
+        cout<<"ERROR: cannot write kernel bank "<<file_name<<endl;
+        return;
+    }
 
-    //compute rotational kernels
-    Image *kernel = new Image();
-    for(int j = 0; j < 12; j++){
-        //rotate kernel
-        gmf_rotated[j] = rotatekernel(gmf_kernel,gmf_params[1]+extraL,gmf_params[2]+extraT,15*(j),false);
-        //print kernel
-        kernel->setImage(gmf_rotated[j],gmf_params[1]+extraL,gmf_params[2]+extraT,true,true);
-        kernel->normalize();
-        kernel->pgmWrite("kernel" + to_string(15*(j)) + ".pgm","kernel rotated");
-        
+    file << key << endl;
+    file << gmf_bank->rotated.size() << " " << gmf_bank->k_rows << " " << gmf_bank->k_cols << endl;
+    for(int n = 0; n < (int)gmf_bank->rotated.size(); n++){
+        for(int i = 0; i < gmf_bank->k_rows; i++){
+            for(int j = 0; j < gmf_bank->k_cols; j++){
+                file << gmf_bank->rotated[n][i][j] << " ";
+            }
+            file << endl;
+        }
+    }
+    file.close();
+}
+
+/*read kernel bank from a text file, returning nullptr if missing or built with other parameters*/
+GMFKernelBank* loadGMFKernelBank(string file_name, string key){
+    ifstream file(file_name);
+    if(!file.is_open())
+        return nullptr;
+
+    string file_key;
+    int n_kernels = 0, k_rows = 0, k_cols = 0;
+    getline(file, file_key);
+    file >> n_kernels >> k_rows >> k_cols;
+    if(file_key != key || n_kernels < 1 || k_rows < 1 || k_cols < 1)
+        return nullptr;
+
+    GMFKernelBank* gmf_bank = new GMFKernelBank();
+    gmf_bank->k_rows = k_rows;
+    gmf_bank->k_cols = k_cols;
+    for(int n = 0; n < n_kernels; n++){
+        int** kernel = createMatrix(k_rows, k_cols, 0);
+        for(int i = 0; i < k_rows; i++){
+            for(int j = 0; j < k_cols; j++){
+                file >> kernel[i][j];
+            }
+        }
+        gmf_bank->rotated.push_back(kernel);
+    }
+
+    if(file.fail()){
+        for(int n = 0; n < (int)gmf_bank->rotated.size(); n++){
+            freeMatrix(gmf_bank->rotated[n], k_rows);
+        }
+        delete gmf_bank;
+        return nullptr;
+    }
+    return gmf_bank;
+}
+
+/*get rotated gaussian matching filter bank, building it only once per process
+    [0]-sigma, [1]-L_len, [2]-T_len; angles 0, angle_step, ... < 180
+    with gmf_bank_dir set, an on-disk bank file there is reused when present and written otherwise
+*/
+GMFKernelBank* getGMFKernelBank(int* gmf_params, int angle_step, int extra_L, int extra_T){
+    string key = "gmf_" + to_string(gmf_params[0]) + "_" + to_string(gmf_params[1]) + "_" + to_string(gmf_params[2])
+                 + "_" + to_string(angle_step) + "_" + to_string(extra_L) + "_" + to_string(extra_T);
+
+    //process cache
+    if(gmf_bank_cache.count(key))
+        return gmf_bank_cache[key];
+
+    //on-disk bank
+    string file_name = gmf_bank_dir + key + ".bank";
+    GMFKernelBank* gmf_bank = nullptr;
+    if(gmf_bank_dir.size() != 0)
+        gmf_bank = loadGMFKernelBank(file_name, key);
+
+    //build from parameters
+    if(gmf_bank == nullptr){
+        gmf_bank = new GMFKernelBank();
+        gmf_bank->k_rows = gmf_params[1]+extra_L;
+        gmf_bank->k_cols = gmf_params[2]+extra_T;
+        int** gmf_kernel = createGMFkernel(gmf_params,extra_L,extra_T);
+        for(int angle = 0; angle < 180; angle += angle_step){
+            gmf_bank->rotated.push_back(rotatekernel(gmf_kernel,gmf_bank->k_rows,gmf_bank->k_cols,angle,false));
+        }
+        freeMatrix(gmf_kernel,gmf_bank->k_rows);
+
+        if(gmf_bank_dir.size() != 0)
+            saveGMFKernelBank(file_name, key, gmf_bank);
     }
 
+    gmf_bank->bank = compileFilterBank(gmf_bank->rotated.data(),gmf_bank->rotated.size(),gmf_bank->k_rows,gmf_bank->k_cols);
+
+    //print kernels
+    if(debug_dump){
+        Image *kernel = new Image();
+        for(int j = 0; j < (int)gmf_bank->rotated.size(); j++){
+            kernel->setImage(gmf_bank->rotated[j],gmf_bank->k_rows,gmf_bank->k_cols,true,true);
+            kernel->normalize();
+            kernel->pgmWrite("kernel" + to_string(angle_step*(j)) + ".pgm","kernel rotated");
+        }
+        delete kernel;
+    }
+
+    gmf_bank_cache[key] = gmf_bank;
+    return gmf_bank;
+}
+
+/*enhance images with matching gaussian filter*/
+void gaussianMatchingFilter(int* gmf_params, int ref_path, int angle_step = 15){
+
+    //rotated gaussian matching filters evaluated together
+    GMFKernelBank* gmf_bank = getGMFKernelBank(gmf_params,angle_step,gmf_params[1]/2,gmf_params[2]/2);
+    //max filter response and winning orientation
+    int** img_matrix;
+    int** img_angle;
+
+    Image *img;
+
     //apply filter to datset
     for(int i = db_init; i < db_init + db_size; i++){
         // Read image
@@ -2289,31 +3751,317 @@ void gaussianMatchingFilter(int* gmf_params, int ref_path){
         else
             img->pgmRead(save_path_enhance + to_string(i) + "_enhance.pgm");
 
-        for(int j = 0; j < 12; j++){
-
-            //apply filter
-            img_aux = img->convolution(gmf_rotated[j],gmf_params[1]+extraL,gmf_params[2]+extraT,false);
-
-            //selecting max response angle for every pixel
-            for(int k=0; k < img->getRows(); k++){
-                for(int l = 0; l < img->getCols(); l++){
-                    if(img_matrix[k][l] < img_aux[k][l]){
-                        img_matrix[k][l] = img_aux[k][l];
-                    }
-                }
+        //selecting max response angle for every pixel
+        img_angle = createMatrix(img->getRows(),img->getCols(),0);
+        img_matrix = applyFilterBank(gmf_bank->bank,img->getImage(),img->getRows(),img->getCols(),img_angle);
+        for(int k=0; k < img->getRows(); k++){
+            for(int l = 0; l < img->getCols(); l++){
+                //negative responses are discarded
+                if(img_matrix[k][l] < 0)
+                    img_matrix[k][l] = 0;
+                //index to degrees
+                img_angle[k][l] *= angle_step;
             }
-            delete img_aux[0];
-            delete img_aux;
         }
         
         // Set resulting image
         img_matrix = img->normalize(img_matrix);
         img->pgmWrite(save_path_enhance + to_string(i) + "_enhance.pgm","image enhanced with gaussian matching filter",img_matrix);
+        img->pgmWrite(save_path_enhance + to_string(i) + "_angle.pgm","orientation of max gaussian matching filter response (degrees)",img_angle);
+        freeMatrix(img_matrix,img->getRows());
+        freeMatrix(img_angle,img->getRows());
         delete img;
         
     }
+}
 
-    delete kernel;
+/*declarative parameter grid, every combination of the given lists is one sweep point
+    morphological enhancements: shapes x radii x enhance_types, gaussian matching filter enhancements: gmf_params
+    every enhancement is segmented with maxima_t x connected_thresh (Yanowitz), empty lists skip segmentation
+*/
+struct SweepGrid{
+    vector<string> shapes;
+    vector<int> radii;
+    vector<int> enhance_types;              //1: image - tophat, 2: image + tophat - blackhat
+    vector<array<int,3>> gmf_params;        //sigma, L, T
+    int gmf_angle_step = 15;
+    vector<int> maxima_t;
+    vector<int> connected_thresh;
+    int surface_solver = SURFACE_SOR;       //SURFACE_SOR, SURFACE_MULTIGRID or SURFACE_RED_BLACK
+};
+
+/*one evaluated point of a sweep (f1 = -1 without segmentation)*/
+struct SweepResult{
+    string method;                          //strel shape or "gmf"
+    int radius = 0;
+    int enhancetype = 0;
+    int gmf[3] = {0,0,0};
+    int maxima_t = 0;
+    int connected_thresh = 0;
+    double auc = 0;
+    double f1 = -1;
+};
+
+/*enhancement of a sweep and its images while they are segmented*/
+struct SweepEnhancement{
+    SweepResult params;
+    int** strel = nullptr;
+    GMFKernelBank* gmf_bank = nullptr;
+    bool vessel_black = true;               //morphological enhancements keep dark vessels
+    ClassHistogram counts;
+    vector<Image*> enhanced;
+};
+
+/*evaluate every point of grid on the training dataset, scheduling points across n_threads (0: hardware threads)
+    the dataset, masks and groundtruth are loaded once and shared read only by every task
+    1. enhancement x image tasks: enhance, fold into the AUC counts and keep the image if it will be segmented
+    2. enhancement x maxima_t tasks: one Yanowitz threshold surface per image, reused for every connected_thresh
+*/
+vector<SweepResult> runParameterSweep(const SweepGrid &grid, int n_threads = 0){
+    if(n_threads <= 0)
+        n_threads = hardwareThreads();
+
+    vector<Image*> &images = trainingImages();
+    int n_images = images.size();
+
+    //shared masks and groundtruth
+    ROC reference;
+    reference.buildMaskArray(mask_path,db_size,db_init);
+    reference.buildGroundthruthArray(gt_path,db_size,db_init);
+    vector<Image*> masks, groundtruth;
+    for(int i = 0; i < n_images; i++){
+        masks.push_back(reference.getImage(i,2));
+        groundtruth.push_back(reference.getImage(i,3));
+    }
+
+    //enhancements of the grid, strels and filter banks are built before any task runs
+    vector<SweepEnhancement> enhancements;
+    for(int s = 0; s < (int)grid.shapes.size(); s++){
+        for(int r = 0; r < (int)grid.radii.size(); r++){
+            for(int e = 0; e < (int)grid.enhance_types.size(); e++){
+                int radius = grid.radii[r];
+                SweepEnhancement enhancement;
+                enhancement.params.method = grid.shapes[s];
+                enhancement.params.radius = radius;
+                enhancement.params.enhancetype = grid.enhance_types[e];
+                enhancement.strel = createStrel(grid.shapes[s],1,radius*2+1,radius*2+1,radius,0);
+                enhancements.push_back(enhancement);
+            }
+        }
+    }
+    for(int g = 0; g < (int)grid.gmf_params.size(); g++){
+        int gmf_params[3] = {grid.gmf_params[g][0],grid.gmf_params[g][1],grid.gmf_params[g][2]};
+        SweepEnhancement enhancement;
+        enhancement.params.method = "gmf";
+        copy(gmf_params, gmf_params + 3, enhancement.params.gmf);
+        enhancement.gmf_bank = getGMFKernelBank(gmf_params,grid.gmf_angle_step,gmf_params[1]/2,gmf_params[2]/2);
+        enhancement.vessel_black = false;
+        enhancements.push_back(enhancement);
+    }
+    int n_enhancements = enhancements.size();
+    bool segment = grid.maxima_t.size() > 0 && grid.connected_thresh.size() > 0;
+    for(int k = 0; k < n_enhancements; k++){
+        enhancements[k].enhanced.assign(n_images,nullptr);
+    }
+
+    //1. enhancement x image tasks
+    vector<mutex> counts_lock(n_enhancements);
+    parallelTasks(n_enhancements*n_images, [&](int task){
+        SweepEnhancement &enhancement = enhancements[task / n_images];
+        int i = task % n_images;
+        int rows = images[i]->getRows();
+        int cols = images[i]->getCols();
+
+        Image *enhanced = new Image();
+        if(enhancement.gmf_bank == nullptr){
+            enhanced->setImage(enhancePipeline(images[i]->getImage(),rows,cols,enhancement.strel,enhancement.params.radius,enhancement.params.enhancetype),rows,cols);
+        }else{
+            int** response = applyFilterBank(enhancement.gmf_bank->bank,images[i]->getImage(),rows,cols,nullptr,1);
+            for(int y = 0; y < rows; y++){
+                for(int x = 0; x < cols; x++){
+                    //negative responses are discarded
+                    if(response[y][x] < 0)
+                        response[y][x] = 0;
+                }
+            }
+            enhanced->setImage(response,rows,cols);
+            enhanced->normalize();
+        }
+
+        //ROC counts need vessels brighter than background
+        ClassHistogram hist;
+        if(enhancement.vessel_black){
+            int** inverted = createMatrix(rows,cols,0);
+            int** img = enhanced->getImage();
+            for(int y = 0; y < rows; y++){
+                for(int x = 0; x < cols; x++){
+                    inverted[y][x] = 255 - img[y][x];
+                }
+            }
+            hist = reference.imageHistogram(inverted,rows,cols,i);
+            freeMatrix(inverted,rows);
+        }else{
+            hist = reference.imageHistogram(enhanced->getImage(),rows,cols,i);
+        }
+        {
+            lock_guard<mutex> guard(counts_lock[task / n_images]);
+            enhancement.counts.add(hist);
+        }
+
+        if(segment)
+            enhancement.enhanced[i] = enhanced;
+        else
+            delete enhanced;
+    }, n_threads);
+
+    vector<SweepResult> results;
+    for(int k = 0; k < n_enhancements; k++){
+        enhancements[k].params.auc = histogramAUC(enhancements[k].counts);
+        if(!segment)
+            results.push_back(enhancements[k].params);
+    }
+
+    //2. enhancement x maxima_t tasks, every task segments its own copy of the enhanced images
+    if(segment){
+        int n_maxima = grid.maxima_t.size();
+        int n_connected = grid.connected_thresh.size();
+        results.assign(n_enhancements*n_maxima*n_connected, SweepResult());
+
+        parallelTasks(n_enhancements*n_maxima, [&](int task){
+            SweepEnhancement &enhancement = enhancements[task / n_maxima];
+            int maxima_t = grid.maxima_t[task % n_maxima];
+
+            Segment segmentation;
+            segmentation.setSurfaceSolver(grid.surface_solver);
+            segmentation.setReferenceImages(masks,groundtruth);
+            for(int i = 0; i < n_images; i++){
+                Image *img = new Image();
+                img->setImage(enhancement.enhanced[i]->getImage(),enhancement.enhanced[i]->getRows(),enhancement.enhanced[i]->getCols(),false,true);
+                segmentation.addImage(img);
+            }
+
+            for(int c = 0; c < n_connected; c++){
+                segmentation.yanowitzStaged(n_images,"",maxima_t,grid.connected_thresh[c],enhancement.vessel_black);
+                segmentation.calculateConfusionMatrix();
+
+                SweepResult result = enhancement.params;
+                result.maxima_t = maxima_t;
+                result.connected_thresh = grid.connected_thresh[c];
+                result.f1 = segmentation.f1Score();
+                results[task*n_connected + c] = result;
+                segmentation.clearArray(4);
+            }
+            segmentation.clearArray(1);
+        }, n_threads);
+    }
+
+    //clear memory
+    for(int k = 0; k < n_enhancements; k++){
+        for(int i = 0; i < (int)enhancements[k].enhanced.size(); i++){
+            delete enhancements[k].enhanced[i];
+        }
+        if(enhancements[k].strel != nullptr)
+            freeMatrix(enhancements[k].strel,enhancements[k].params.radius*2+1);
+    }
+    return results;
+}
+
+/*write sweep results as a CSV table, returns 0 on error*/
+int writeSweepCSV(string file_name, const vector<SweepResult> &results){
+    ofstream file(file_name);
+    if(!file.is_open()){
+        cout<<"ERROR: cannot write sweep results "<<file_name<<endl;
+        return 0;
+    }
+
+    file << "method,radius,enhance_type,gmf_sigma,gmf_L,gmf_T,maxima_t,connected_thresh,auc,f1" << endl;
+    file << setprecision(10);
+    for(int k = 0; k < (int)results.size(); k++){
+        const SweepResult &r = results[k];
+        file << r.method << "," << r.radius << "," << r.enhancetype << "," << r.gmf[0] << "," << r.gmf[1] << "," << r.gmf[2] << ",";
+        file << r.maxima_t << "," << r.connected_thresh << "," << r.auc << ",";
+        if(r.f1 >= 0)
+            file << r.f1;
+        file << endl;
+    }
+    file.close();
+    return 1;
+}
+
+/*write sweep results as a JSON array of objects (f1 is null without segmentation), returns 0 on error*/
+int writeSweepJSON(string file_name, const vector<SweepResult> &results){
+    ofstream file(file_name);
+    if(!file.is_open()){
+        cout<<"ERROR: cannot write sweep results "<<file_name<<endl;
+        return 0;
+    }
+
+    file << "[" << endl;
+    file << setprecision(10);
+    for(int k = 0; k < (int)results.size(); k++){
+        const SweepResult &r = results[k];
+        file << "  {\"method\": \"" << r.method << "\", \"radius\": " << r.radius << ", \"enhance_type\": " << r.enhancetype;
+        file << ", \"gmf\": [" << r.gmf[0] << ", " << r.gmf[1] << ", " << r.gmf[2] << "]";
+        file << ", \"maxima_t\": " << r.maxima_t << ", \"connected_thresh\": " << r.connected_thresh;
+        file << ", \"auc\": " << r.auc << ", \"f1\": ";
+        if(r.f1 >= 0)
+            file << r.f1;
+        else
+            file << "null";
+        file << "}" << (k + 1 < (int)results.size() ? "," : "") << endl;
+    }
+    file << "]" << endl;
+    file.close();
+    return 1;
+}
+
+/*print sweep results as a table*/
+void printSweepResults(const vector<SweepResult> &results){
+    cout << setw(12) << left << "|Method" << setw(8) << left << "|Radio" << setw(8) << left << "|Type" << setw(12) << left << "|GMF";
+    cout << setw(10) << left << "|Maxima" << setw(10) << left << "|Connect" << setw(12) << left << "|AUC" << setw(10) << left << "|F-1 Score" << endl;
+    for(int k = 0; k < (int)results.size(); k++){
+        const SweepResult &r = results[k];
+        string gmf = r.method == "gmf" ? to_string(r.gmf[0]) + "," + to_string(r.gmf[1]) + "," + to_string(r.gmf[2]) : "-";
+        cout << setw(12) << left << r.method << setw(8) << left << r.radius << setw(8) << left << r.enhancetype << setw(12) << left << gmf;
+        cout << setw(10) << left << r.maxima_t << setw(10) << left << r.connected_thresh << setw(12) << left << r.auc;
+        if(r.f1 >= 0)
+            cout << setw(10) << left << r.f1;
+        cout << endl;
+    }
+}
+
+/*run a sweep, print it and write file_prefix.csv and file_prefix.json*/
+void parameterSweep(const SweepGrid &grid, string file_prefix){
+    auto start = chrono::steady_clock::now();
+    vector<SweepResult> results = runParameterSweep(grid);
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+    printSweepResults(results);
+    writeSweepCSV(file_prefix + ".csv",results);
+    writeSweepJSON(file_prefix + ".json",results);
+    cout<<results.size()<<" sweep points in "<<seconds<<" s, results in "<<file_prefix<<".csv and "<<file_prefix<<".json"<<endl;
+}
+
+/*Test different parameters for image enhancement (every shape and radius), writing enhance_sweep.csv / .json*/
+void testEnhanceParams(string* strel_names, int n_shapes, int* strel_radii, int n_radii, int enhancetype){
+    SweepGrid grid;
+    grid.shapes.assign(strel_names, strel_names + n_shapes);
+    grid.radii.assign(strel_radii, strel_radii + n_radii);
+    grid.enhance_types.push_back(enhancetype);
+    parameterSweep(grid,"enhance_sweep");
+}
+
+/*Sweep enhancement and Yanowitz segmentation parameters together, writing segment_sweep.csv / .json*/
+void testSweepParams(){
+    SweepGrid grid;
+    grid.shapes = {"diamond","disk"};
+    grid.radii = {4,8};
+    grid.enhance_types = {2};
+    grid.gmf_params = {{2,9,13}};
+    grid.maxima_t = {20,40,60,80};
+    grid.connected_thresh = {50,60,70,80};
+    grid.surface_solver = SURFACE_SOR;
+    parameterSweep(grid,"segment_sweep");
 }
 
 /*soft the hiighest valued gradient edge of the set of images*/
@@ -2425,12 +4173,8 @@ void testSegmentParams(){
     int max_thresh[] = {20, 40, 60, 80};
 
     //enhance pipeline
-    //smooth original images
-    smoothImages(1);
-    //increase contrast whitehat - blackhat
-    enhanceSymetricStrel("diamond",strel_params,2,2);
-    enhanceSymetricStrel("diamond",strel_params,2,2);
-    enhanceSymetricStrel("diamond",strel_params,2,2);
+    //smooth original images and increase contrast whitehat - blackhat three times, streamed in one pass
+    enhanceSymetricStrel("diamond",strel_params,2,1,3,true);
 
     //evalute every strel name and size combination
     cout << setw(20) << left << "|Method" << setw(10) << left << "|max-thresh; connect-thresh" << setw(10) << "|F-1 Score" << endl;
@@ -2440,13 +4184,17 @@ void testSegmentParams(){
     drive_training.buildMaskArray(mask_path,db_size,db_init);
     drive_training.buildGroundthruthArray(gt_path,db_size,db_init);
 
+    bool VisB;
+    cout<<"Vessel is Black? : ";
+    cin>>VisB;
+
     //connect threshold 
     for(int i = 0; i < 4; i++){
 
-        //max gradient threshold
+        //max gradient threshold (gradients, surfaces and labels are reused across the grid)
         for(int j = 0; j < 4; j++){
             //threshold surface method
-            drive_training.yanowitz_method(db_size,save_path_segment,max_thresh[j], connected_thresh[i]);
+            drive_training.yanowitzStaged(db_size,save_path_segment,max_thresh[j], connected_thresh[i],VisB);
             drive_training.calculateConfusionMatrix();
             drive_training.printROCData("Surface",to_string(max_thresh[j]) + "," + to_string(connected_thresh[i]));
             drive_training.clearArray(4);
@@ -2460,6 +4208,7 @@ void testSegmentParams(){
         drive_training.clearArray(4);
         
     }
+    drive_training.printStageCounts();
 }
 
 /*compute metrics with enhanced images without segmentation*/
@@ -2476,8 +4225,10 @@ void computeMetrics(){
 }
 
 /*Segment using surface of images*/
-void segmentSurfaceYanowitz(int maxima_t, int threshold){
+void segmentSurfaceYanowitz(int maxima_t, int threshold, int surface_solver = SURFACE_SOR, double omega = 0, int maxima_anchor = MAXIMA_ANCHOR_CORNER){
     Segment drive_training;
+    drive_training.setSurfaceSolver(surface_solver,omega);
+    drive_training.setMaximaAnchor(maxima_anchor);
     drive_training.buildImageArray(save_path_enhance,db_size,db_init);
     drive_training.buildMaskArray(mask_path,db_size,db_init);
     drive_training.buildGroundthruthArray(gt_path,db_size,db_init);
@@ -2489,13 +4240,61 @@ void segmentSurfaceYanowitz(int maxima_t, int threshold){
     cin>>temp;
 }
 
-/*Segment using iterative thresholding computation*/
-void segmentSurfaceIterative(int threshold){
+/*F1-score and surface time of Yanowitz with the threshold surface solved on coarse grids
+    factors of 1/4 and 1/8 of the image side, bilinear and bicubic upsampling, converged solvers only (multigrid or red-black SOR)
+    deltas and speedups are against the legacy full resolution SOR (first row)
+*/
+void compareSurfaceGrids(int maxima_t, int threshold, int surface_solver = SURFACE_MULTIGRID){
+    if(surface_solver != SURFACE_MULTIGRID && surface_solver != SURFACE_RED_BLACK){
+        cout<<"Coarse grids need a converged solver, comparing with multigrid"<<endl;
+        surface_solver = SURFACE_MULTIGRID;
+    }
+
+    Segment drive_training;
+    drive_training.buildImageArray(save_path_enhance,db_size,db_init);
+    drive_training.buildMaskArray(mask_path,db_size,db_init);
+    drive_training.buildGroundthruthArray(gt_path,db_size,db_init);
+
+    bool VisB;
+    cout<<"Vessel is Black? : ";
+    cin>>VisB;
+
+    int solvers[] = {SURFACE_SOR, surface_solver, surface_solver, surface_solver, surface_solver, surface_solver};
+    int factors[] = {1, 1, 4, 4, 8, 8};
+    int upsample[] = {UPSAMPLE_BILINEAR, UPSAMPLE_BILINEAR, UPSAMPLE_BILINEAR, UPSAMPLE_BICUBIC, UPSAMPLE_BILINEAR, UPSAMPLE_BICUBIC};
+    string solver_names[] = {"", "SOR", "multigrid", "red-black"};
+    string upsample_names[] = {"", "bilinear", "bicubic"};
+    double ref_f1 = 0, ref_seconds = 0;
+
+    cout << setw(12) << left << "|solver" << setw(8) << left << "|grid" << setw(12) << left << "|upsample" << setw(12) << left << "|F-1 Score" << setw(12) << left << "|delta F-1" << setw(12) << left << "|surface s" << "|speedup" << endl;
+    for(int k = 0; k < 6; k++){
+        drive_training.setSurfaceSolver(solvers[k]);
+        drive_training.setSurfaceGrid(factors[k],upsample[k]);
+        drive_training.yanowitzStaged(db_size,"",maxima_t,threshold,VisB);
+        drive_training.calculateConfusionMatrix();
+
+        double f1 = drive_training.f1Score();
+        double seconds = drive_training.surfaceSeconds();
+        if(k == 0){
+            ref_f1 = f1;
+            ref_seconds = seconds;
+        }
+        cout << setw(12) << left << solver_names[solvers[k]] << setw(8) << left << ("1/" + to_string(factors[k])) << setw(12) << left << (factors[k] == 1 ? "-" : upsample_names[upsample[k]]);
+        cout << setw(12) << left << f1 << setw(12) << left << f1 - ref_f1 << setw(12) << left << seconds << ref_seconds / max(seconds,1e-9) << "x" << endl;
+        drive_training.clearArray(4);
+    }
+    cout<<">>Segmentation process finished"<<endl;
+    string temp;
+    cin>>temp;
+}
+
+/*Segment using iterative (method = 1) or Otsu (method = 2) thresholding computation*/
+void segmentSurfaceIterative(int threshold, int method = 1){
     Segment drive_training;
     drive_training.buildImageArray(save_path_enhance,db_size,db_init);
     drive_training.buildMaskArray(mask_path,db_size,db_init);
     drive_training.buildGroundthruthArray(gt_path,db_size,db_init);
-    drive_training.iterative_method(db_size,save_path_segment,threshold);
+    drive_training.iterative_method(db_size,save_path_segment,threshold,method);
     drive_training.calculateConfusionMatrix();
     drive_training.metrics();
     cout<<">>Segmentation process finished"<<endl;
@@ -2514,6 +4313,78 @@ void skeletonization(){
     cin>>temp;
 }
 
+/*enhance whole dataset streaming every image in bands of band_rows rows
+    halo rows come from the vertical support of the pipeline, so bands are stitched without seams
+*/
+void enhanceTiled(string strel_name, int strel_params[], int enhancetype, int ref_path, int band_rows, int n_passes = 1, bool smooth = false){
+    int** strel = createStrel(strel_name,strel_params[0],strel_params[1],strel_params[2],strel_params[3],strel_params[4]);
+
+    //support of the chain measured on an empty source
+    vector<unique_ptr<RowNode>> probe_nodes;
+    SourceNode probe(nullptr,0,0);
+    int halo = buildEnhancePipeline(probe_nodes,&probe,strel,strel_params[3],enhancetype,n_passes,smooth)->support();
+
+    string pgm_desc = (enhancetype == 1) ? "image - topkhat, " : "image + tophat - blackhat, ";
+
+    for(int i = db_init; i < db_init + db_size; i++){
+        string input_file = (ref_path == 1) ? db_path + to_string(i) + "_training.pgm" : save_path_enhance + to_string(i) + "_enhance.pgm";
+        //write to a temporary file in case input and output are the same image
+        string output_file = save_path_enhance + to_string(i) + "_enhance.pgm";
+        string temp_file = output_file + ".tmp";
+
+        int ok = processBands({input_file},temp_file,band_rows,halo,[&](const vector<int**> &in, int n_rows, int n_cols, int, int, int) -> int**{
+            vector<unique_ptr<RowNode>> nodes;
+            SourceNode source(in[0],n_rows,n_cols);
+            return runPipeline(buildEnhancePipeline(nodes,&source,strel,strel_params[3],enhancetype,n_passes,smooth));
+        },0,pgm_desc + strel_name);
+
+        if(ok)
+            rename(temp_file.c_str(),output_file.c_str());
+        cout<<output_file<<endl;
+    }
+
+    freeMatrix(strel,2*strel_params[3]+1);
+}
+
+/*Yanowitz segmentation of the whole dataset streaming each image in bands
+    grid_factor = 1 gives the same result as yanowitz_method when the image fits in one band,
+    otherwise it is raised so the coarse threshold surface is no larger than a band
+*/
+void segmentYanowitzTiled(int maxima_t, int threshold, int band_rows, int grid_factor = 1){
+    bool VisB;
+    cout<<"Vessel is Black? : ";
+    cin>>VisB;
+
+    Segment drive_training;
+    for(int i = db_init; i < db_init + db_size; i++){
+        string output_file = save_path_segment + to_string(i) + "_segmented.pgm";
+        drive_training.yanowitzTiled(save_path_enhance + to_string(i) + "_enhance.pgm",mask_path + to_string(i) + "_training_mask.pgm",output_file,maxima_t,threshold,band_rows,VisB,grid_factor);
+        cout<<output_file<<endl;
+    }
+}
+
+/*skeletonize segmented images streaming them in bands, halo rows bound the thinning steps per band*/
+void skeletonizationTiled(int band_rows, int halo = 64){
+    string save_path_skeleton = "src/db_coronary/skeletonized/";
+
+    for(int i = db_init; i < db_init + db_size; i++){
+        string output_file = save_path_skeleton + to_string(i) + "_skeleton.pgm";
+        //every sub-iteration that removes pixels moves changes one row, beyond halo of them bands may differ from whole image thinning
+        atomic<bool> truncated(false);
+
+        processBands({save_path_segment + to_string(i) + "_segmented.pgm"},output_file,band_rows,halo,[&](const vector<int**> &in, int n_rows, int n_cols, int, int, int) -> int**{
+            int** band = copyImage(in[0],n_rows,n_cols);
+            if(zhangSuenThinning(band,n_rows,n_cols,halo) >= halo)
+                truncated = true;
+            return band;
+        },0,"Skeletonized image with Shang-Suen algorithm");
+
+        if(truncated)
+            cout<<"Warning: thinning needs more than "<<halo<<" steps, increase halo rows: "<<output_file<<endl;
+        cout<<output_file<<endl;
+    }
+}
+
 /*calculate vessel width */
 void vesselWidth(){
 
@@ -2522,7 +4393,8 @@ void vesselWidth(){
     int vessel_t = 10;  // vessel max threshold
     int scale = 50;     // scaling factor to visualize radii image
     Image edge, skeleton, mask;
-    int** radii_image;
+    double** radii_image;
+    int** radii_print;
 
     //stats variables
     double max = 0, min = 1000, avg = 0, n_pixels = 0;
@@ -2540,42 +4412,41 @@ void vesselWidth(){
         
         //compare Canny edge with skeletonized vessel
         skeleton.pgmRead(save_path_skeleton + to_string(i) + "_skeleton.pgm");
-        radii_image = skeleton.radialEdgeSearch(edge.getImage(),mask.getImage(),vessel_t,scale);
-
-        //print radii map
-        skeleton.pgmWrite(save_path_width + to_string(i)+"_radii.pgm","Radii map",radii_image);
+        radii_image = skeleton.edgeDistance(edge.getImage(),mask.getImage(),vessel_t);
 
         //compute vessel stats
+        radii_print = createMatrix(skeleton.getRows(),skeleton.getCols(),0);
         for(int k = 0; k < skeleton.getRows(); k++){
             for(int l = 0; l < skeleton.getCols(); l++){
                 if(radii_image[k][l] == 0)
                     continue;
 
-                if(max < radii_image[k][l]/scale)
-                    max = radii_image[k][l] / scale;
-                if(min > radii_image[k][l]/scale){
-                    if(radii_image[k][l] < 0)
-                        min = 0.5;  //possible fraction represented as unique negative value
-                    else
-                        min = radii_image[k][l] / scale;
-                }
+                if(max < radii_image[k][l])
+                    max = radii_image[k][l];
+                if(min > radii_image[k][l])
+                    min = radii_image[k][l];
                     
                 n_pixels++;
-                if(radii_image[k][l] < 0)
-                    avg += 0.5;
-                else
-                    avg += (radii_image[k][l] / scale);
+                avg += radii_image[k][l];
+
+                //scaled radii for visualization
+                radii_print[k][l] = round(radii_image[k][l]*scale);
+                if(radii_print[k][l] > 255)
+                    radii_print[k][l] = 255;
             }
         }
 
+        //print radii map
+        skeleton.pgmWrite(save_path_width + to_string(i)+"_radii.pgm","Radii map",radii_print);
+
         cout << setw(13) << left << "  "+to_string(i) << setw(14) << left << "  " + to_string(min) << setw(14) << "  " + to_string(max)  << setw(14) << left << avg/n_pixels <<endl;
         max = 0;
         min = 1000;
         avg = 0; 
         n_pixels = 0;
 
-        delete radii_image[0];
-        delete radii_image;
+        freeMatrix(radii_image,skeleton.getRows());
+        freeMatrix(radii_print,skeleton.getRows());
     }
 
     cout<<">>Vessel width process finished"<<endl;
@@ -2769,7 +4640,6 @@ void morphological_interface(int enhancetype, int ref_path){
     string strel_names[]= {"diamond","disk"};
     int strel_radii[] = {2,4,6,8};
     int strel_params[5] = {1,0,0,0,0};
-    int n_tests = 2*4;
 
     while (option != 0){
         /*morphological submenu */
@@ -2778,6 +4648,9 @@ void morphological_interface(int enhancetype, int ref_path){
         cout<<"| 2. Diamond                       |\n";
         cout<<"| 3. Round                         |\n";
         cout<<"| 4. Binary descriptor             |\n";
+        cout<<"| 5. Binary descriptor (pyramid)   |\n";
+        cout<<"| 6. Binary descriptor (genetic)   |\n";
+        cout<<"| 7. Binary descriptor (annealing) |\n";
         cout<<"| 0. Return                        |\n";
         cout<<"|----------------------------------|\n";
         cout<<"Select a structuring element: ";
@@ -2787,7 +4660,7 @@ void morphological_interface(int enhancetype, int ref_path){
         case 1:
             //------------------------------------------------test for differents enhance params
             //structuring element parameters: weight, rows, cols, radius, angle=0
-            testEnhanceParams(strel_names,strel_params,strel_radii,n_tests,enhancetype-1);
+            testEnhanceParams(strel_names,2,strel_radii,4,enhancetype-1);
             break;
         case 2:
             strel_params[3] = 8;
@@ -2801,6 +4674,15 @@ void morphological_interface(int enhancetype, int ref_path){
         case 4:
             enhanceBinaryDescriptor(strel_params);
             break;
+        case 5:
+            enhanceBinaryDescriptor(strel_params,OPTIMIZER_ILS,4);
+            break;
+        case 6:
+            enhanceBinaryDescriptor(strel_params,OPTIMIZER_GENETIC);
+            break;
+        case 7:
+            enhanceBinaryDescriptor(strel_params,OPTIMIZER_ANNEALING);
+            break;
         case 0:
             break;
         default:
@@ -2826,6 +4708,7 @@ void enhance_interface(){
         cout<<"| 4. Gaussian smooth filter        |\n";
         cout<<"| 5. Gaussian Matching Filter      |\n";
         cout<<"| 6. Invert values                 |\n";
+        cout<<"| 7. Toggle debug kernel dumps     |\n";
         
         cout<<"\n\n| 8. Set original image path       |\n";
         cout<<"| 9. Set last enhance as new image |\n";
@@ -2861,7 +4744,7 @@ void enhance_interface(){
             invertImages(ref_path);
             break;
         case 7:
-
+            debug_dump = !debug_dump;
             break;
         case 8:
             ref_path = 1;
@@ -2881,6 +4764,9 @@ void segment_interface(){
     int option = 100;
     int threshold;
     int maxima_t;
+    double omega;
+    int solver;
+    int maxima_anchor = MAXIMA_ANCHOR_CORNER;
 
     while (option != 0){
         /*Segment submenu */
@@ -2889,6 +4775,12 @@ void segment_interface(){
         cout<<"| 2. Convex Hull                   |\n";
         cout<<"| 3. Iterative thresholding        |\n";
         cout<<"| 4. Evaluate methods              |\n";
+        cout<<"| 5. Otsu thresholding             |\n";
+        cout<<"| 6. Parameter sweep (CSV / JSON)  |\n";
+        cout<<"| 7. Surface (multigrid solver)    |\n";
+        cout<<"| 8. Surface (red-black SOR)       |\n";
+        cout<<"| 9. Surface coarse grid (F1 delta)|\n";
+        cout<<"| 10. Maxima window ("<<setw(14)<<left<<(maxima_anchor == MAXIMA_ANCHOR_CENTRE ? "centred)" : "corner)")<<"|\n";
         cout<<"| 0. Return                        |\n";
         cout<<"|----------------------------------|\n";
         cout<<"Select an option: ";
@@ -2901,7 +4793,7 @@ void segment_interface(){
             cin>>threshold;
             cout<<"threshold for local maxima: ";
             cin>>maxima_t;
-            segmentSurfaceYanowitz(maxima_t,threshold);
+            segmentSurfaceYanowitz(maxima_t,threshold,SURFACE_SOR,0,maxima_anchor);
 
             break;
         case 2:
@@ -2915,6 +4807,100 @@ void segment_interface(){
         case 4:
             testSegmentParams();
             break;
+        case 5:
+            cout<<"Connecting element threshold: ";
+            cin>>threshold;
+            segmentSurfaceIterative(threshold,2);
+            break;
+        case 6:
+            testSweepParams();
+            break;
+        case 7:
+            cout<<"Connecting element threshold: ";
+            cin>>threshold;
+            cout<<"threshold for local maxima: ";
+            cin>>maxima_t;
+            segmentSurfaceYanowitz(maxima_t,threshold,SURFACE_MULTIGRID,0,maxima_anchor);
+            break;
+        case 8:
+            cout<<"Connecting element threshold: ";
+            cin>>threshold;
+            cout<<"threshold for local maxima: ";
+            cin>>maxima_t;
+            cout<<"SOR omega (0: optimal): ";
+            cin>>omega;
+            segmentSurfaceYanowitz(maxima_t,threshold,SURFACE_RED_BLACK,omega,maxima_anchor);
+            break;
+        case 9:
+            cout<<"Connecting element threshold: ";
+            cin>>threshold;
+            cout<<"threshold for local maxima: ";
+            cin>>maxima_t;
+            cout<<"Solver (2: multigrid, 3: red-black SOR): ";
+            cin>>solver;
+            compareSurfaceGrids(maxima_t,threshold,solver);
+            break;
+        case 10:
+            maxima_anchor = (maxima_anchor == MAXIMA_ANCHOR_CORNER) ? MAXIMA_ANCHOR_CENTRE : MAXIMA_ANCHOR_CORNER;
+            break;
+        case 0:
+            break;
+        default:
+            cout<<"Invalid option"<<endl;
+            break;
+        }
+        cout<< u8"\033[2J\033[1;1H"; //clear console
+    }
+}
+
+void tiled_interface(){
+    int option = 100;
+    int band_rows = 256;
+    int grid_factor = 1;
+    int threshold;
+    int maxima_t;
+    int strel_params[5] = {1,0,0,8,0};
+
+    while (option != 0){
+        /*Tiled processing submenu, images are streamed in bands of rows */
+        cout<<"|----------------------------------|\n";
+        cout<<"| 1. I + Tophat - Blackhat         |\n";
+        cout<<"| 2. Thresholding surface          |\n";
+        cout<<"| 3. Skeletonization               |\n";
+        cout<<"| 4. Set band rows ("<<setw(5)<<left<<band_rows<<")         |\n";
+        cout<<"| 5. Set surface grid factor ("<<setw(3)<<left<<grid_factor<<") |\n";
+        cout<<"| 0. Return                        |\n";
+        cout<<"|----------------------------------|\n";
+        cout<<"Select an option: ";
+        cin>>option;
+
+        switch (option)
+        {
+        case 1:
+            enhanceTiled("diamond",strel_params,2,1,band_rows);
+            break;
+        case 2:
+            cout<<"Connecting element threshold: ";
+            cin>>threshold;
+            cout<<"threshold for local maxima: ";
+            cin>>maxima_t;
+            segmentYanowitzTiled(maxima_t,threshold,band_rows,grid_factor);
+            break;
+        case 3:
+            skeletonizationTiled(band_rows);
+            break;
+        case 4:
+            cout<<"Rows per band: ";
+            cin>>band_rows;
+            if(band_rows < 1)
+                band_rows = 1;
+            break;
+        case 5:
+            cout<<"Pixels per surface grid cell: ";
+            cin>>grid_factor;
+            if(grid_factor < 1)
+                grid_factor = 1;
+            break;
         case 0:
             break;
         default:
@@ -2935,6 +4921,7 @@ void interface(){
         cout<<"| 3. Skeletonization               |\n";
         cout<<"| 4. Vessel radius                 |\n";
         cout<<"| 5. MTA model                     |\n";
+        cout<<"| 6. Tiled processing (large imgs) |\n";
         cout<<"| 0. Exit                          |\n";
         cout<<"|----------------------------------|\n";
         cout<<"Select an option: ";
@@ -2956,6 +4943,10 @@ void interface(){
             break;
         case 5:
             MTAModeling();
+            break;
+        case 6:
+            tiled_interface();
+            break;
         case 0:
             break;
         default:
@@ -2971,8 +4962,8 @@ void interface(){
 
 
 int main(int argc, char **argv){
-    if(argc != 4){
-        cout << "Error, params: 1. db_path, 2.db_size, 3.db_init" << endl;
+    if(argc != 4 && argc != 5){
+        cout << "Error, params: 1. db_path, 2.db_size, 3.db_init, [4. GMF kernel bank cache directory]" << endl;
         return 1;
     }
 
@@ -2982,6 +4973,12 @@ int main(int argc, char **argv){
     db_init = atoi(argv[3]);
     //set dataset paths
     setDatasetPaths(argv[1]);
+    //optional on-disk cache of GMF kernel banks
+    if(argc == 5){
+        gmf_bank_dir = argv[4];
+        if(gmf_bank_dir.back() != '/')
+            gmf_bank_dir += "/";
+    }
 
     //init interface
     interface();